@@ -0,0 +1,229 @@
+/* See LICENSE for more information on use */
+/* drive every layout through tile() and the client slabs at 100, 1k and 10k clients without a display: make bench */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <X11/Xlib.h>
+#include "defs.h"
+
+#define MON_W 3840
+#define MON_H 2160
+#define RETILES 100
+
+extern const Layout layouts[LAYOUT_COUNT];
+extern Client *workspaces[NUM_WORKSPACES];
+extern int ws_layout[NUM_WORKSPACES];
+extern int ws_nmaster[NUM_WORKSPACES];
+extern Config user_config;
+extern int current_ws;
+extern Monitor *mons;
+extern int monsn;
+extern ClientSlab *client_slabs;
+extern int client_slab_total;
+extern Client **tile_order;
+extern int tile_order_cap;
+extern int *tile_heights;
+extern int tile_heights_cap;
+
+Client *client_alloc(void);
+void client_release(Client *c);
+void tile(void);
+
+/* the only requests tile() makes, answered here instead of by a server */
+static long configures = 0;
+
+int XConfigureWindow(Display *d, Window w, unsigned int mask, XWindowChanges *wc)
+{
+	(void)d, (void)w, (void)mask, (void)wc;
+	configures++;
+	return 1;
+}
+
+int XSetWindowBorder(Display *d, Window w, unsigned long pixel)
+{
+	(void)d, (void)w, (void)pixel;
+	return 1;
+}
+
+static long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static size_t slab_bytes(int *count)
+{
+	size_t bytes = 0;
+	*count = 0;
+	for (ClientSlab *s = client_slabs; s; s = s->next) {
+		bytes += sizeof(ClientSlab) + s->n * sizeof(Client);
+		(*count)++;
+	}
+	return bytes;
+}
+
+/* whether k windows of minimum size and their gaps overflow span */
+static Bool overfull(int k, int span)
+{
+	return k > 0 && k * (2 * user_config.border_width + 1) + (k - 1) * user_config.gaps > span;
+}
+
+/*
+ * every window has to stay inside the tiled area. the exception is a row or column
+ * that cannot fit its windows even at their minimum size, where the last ones overflow
+ */
+static int out_of_bounds(int n, int layout, Bool *expected)
+{
+	int gaps = user_config.gaps, bw2 = 2 * user_config.border_width;
+	int ax = gaps, ay = gaps, aw = MON_W - 2 * gaps, ah = MON_H - 2 * gaps;
+	int nm = MIN(ws_nmaster[current_ws], n);
+	int cols = 1;
+	while (cols * cols < n) {
+		cols++;
+	}
+	switch (layout) {
+		case LAYOUT_TILE:
+			*expected = overfull(nm, ah) || overfull(n - nm, ah);
+			break;
+		case LAYOUT_HORIZONTAL:
+			*expected = overfull(nm, aw) || overfull(n - nm, aw);
+			break;
+		case LAYOUT_GRID:
+			*expected = overfull(cols, aw) || overfull((n + cols - 1) / cols, ah);
+			break;
+		default:
+			*expected = False;
+			break;
+	}
+
+	int bad = 0;
+	for (Client *c = workspaces[current_ws]; c; c = c->next) {
+		if (c->x < ax || c->y < ay || c->x + c->w + bw2 > ax + aw || c->y + c->h + bw2 > ay + ah) {
+			bad++;
+		}
+	}
+	return bad;
+}
+
+static int run(int n)
+{
+	Client *tail = NULL;
+	long start = now_ns();
+	for (int i = 0; i < n; i++) {
+		Client *c = client_alloc();
+		if (!c) {
+			fprintf(stderr, "out of memory at %d clients\n", i);
+			return 0;
+		}
+		c->win = i + 1;
+		c->mapped = True;
+		/* every third one has a user-resized stack height */
+		c->custom_stack_height = (i % 3 == 0) ? 40 : 0;
+		if (tail) {
+			tail->next = c;
+		}
+		else {
+			workspaces[current_ws] = c;
+		}
+		tail = c;
+	}
+	long alloc_ns = now_ns() - start;
+	printf("n=%-6d alloc %7.1fus\n", n, alloc_ns / 1000.0);
+
+	int ok = 1;
+	for (int l = 0; l < LAYOUT_COUNT; l++) {
+		ws_layout[current_ws] = l;
+		/* forget the last layout so every window is configured once */
+		for (Client *c = workspaces[current_ws]; c; c = c->next) {
+			c->x = c->y = c->w = c->h = 0;
+		}
+
+		configures = 0;
+		start = now_ns();
+		tile();
+		long first_ns = now_ns() - start;
+		long first_configures = configures;
+
+		configures = 0;
+		start = now_ns();
+		for (int i = 0; i < RETILES; i++) {
+			tile();
+		}
+		long retile_ns = (now_ns() - start) / RETILES;
+
+		Bool expected;
+		int bad = out_of_bounds(n, l, &expected);
+		printf("  %-10s first %8.1fus (%ld configures)  retile %8.1fus (%ld configures)\n", layouts[l].name,
+		       first_ns / 1000.0, first_configures, retile_ns / 1000.0, configures / RETILES);
+		if (bad) {
+			printf("             %d windows outside the area, %s\n", bad,
+			       expected ? "expected: a row or column cannot fit at minimum size" : "FAIL");
+		}
+		ok &= (!bad || expected) && first_configures == n && configures == 0;
+	}
+
+	int slabs;
+	size_t pool = slab_bytes(&slabs);
+	size_t scratch = tile_order_cap * sizeof(Client *) + tile_heights_cap * sizeof(int);
+
+	/* half the clients go away and come back, the pool must not grow */
+	int before = client_slab_total;
+	Client **prev = &workspaces[current_ws];
+	Client *freed = NULL;
+	for (Client *c = *prev, *next; c; c = next) {
+		next = c->next;
+		if (c->win % 2) {
+			*prev = next;
+			c->next = freed;
+			freed = c;
+		}
+		else {
+			prev = &c->next;
+		}
+	}
+	int nfreed = 0;
+	for (Client *c = freed, *next; c; c = next) {
+		next = c->next;
+		client_release(c);
+		nfreed++;
+	}
+	for (int i = 0; i < nfreed; i++) {
+		Client *c = client_alloc();
+		c->win = n + i + 1;
+		c->mapped = True;
+		c->next = workspaces[current_ws];
+		workspaces[current_ws] = c;
+	}
+	Bool reused = client_slab_total == before;
+
+	printf("  pool %zu KiB in %d slabs (%zu B/client)  scratch %zu KiB  churn %s\n", pool / 1024, slabs,
+	       pool / client_slab_total, scratch / 1024, reused ? "reused the free list" : "GREW THE POOL");
+
+	/* hand everything back for the next size */
+	for (Client *c = workspaces[current_ws], *next; c; c = next) {
+		next = c->next;
+		client_release(c);
+	}
+	workspaces[current_ws] = NULL;
+	return ok && reused;
+}
+
+int main(void)
+{
+	static const int counts[] = {100, 1000, 10000};
+	static Monitor mon = {.w = MON_W, .h = MON_H, .mf = 0.55f};
+
+	mons = &mon;
+	monsn = 1;
+	user_config.gaps = 10;
+	user_config.border_width = 1;
+	ws_nmaster[current_ws] = 1;
+
+	int ok = 1;
+	for (size_t i = 0; i < sizeof counts / sizeof counts[0]; i++) {
+		ok &= run(counts[i]);
+	}
+	return !ok;
+}
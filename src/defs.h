@@ -1,6 +1,8 @@
 /* See LICENSE for more information on use */
 #pragma once
+#include <limits.h>
 #include <X11/Xlib.h>
+#include <xcb/xcb.h>
 #define SXWM_VERSION	"sxwm ver. 1.6"
 #define SXWM_AUTHOR		"(C) Abhinav Prasai 2025"
 #define SXWM_LICINFO	"See LICENSE for more info"
@@ -13,13 +15,20 @@
 #define OUT_IN (2 * BORDER_WIDTH)
 #define MF_MIN 0.05f
 #define MF_MAX 0.95f
-#define MAX_MONITORS 32
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #define LENGTH(X) (sizeof X / sizeof X[0])
 #define UDIST(a,b) abs((int)(a) - (int)(b))
 #define CLAMP(x, lo, hi) (( (x) < (lo) ) ? (lo) : ( (x) > (hi) ) ? (hi) : (x))
-#define MAXCLIENTS	99
+#define CLIENT_SLAB_MIN	64
+#define RULE_BUCKETS	64
+#define KEY_MODS		32
+#define RELOAD_DEBOUNCE_MS	150
+#define IPC_MSG_MAX		(64 * 1024)
+#define IPC_SUB_MAX		(64 * 1024)
+#define HIST_BUCKETS	24
+#define COUNT(m)		(metrics[(m)]++)
+#define client_hash(w) ((unsigned int)((w) * 2654435761u) ^ (unsigned int)((w) >> 16))
 #define BIND(mod, key, cmdstr) { (mod), XK_##key, { cmdstr }, False }
 #define CALL(mod, key, fnptr) { (mod), XK_##key, { .fn = fnptr }, True }
 #define CMD(name, ...) 						\
@@ -30,6 +39,25 @@
 #define TYPE_FUNC	2
 #define TYPE_CMD	3
 
+#define DIRTY_LAYOUT	(1 << 0)
+#define DIRTY_BORDERS	(1 << 1)
+#define DIRTY_STRUTS	(1 << 2)
+#define DIRTY_CLIENTS	(1 << 3)
+#define DIRTY_MAP		(1 << 4)
+#define DIRTY_FOCUS		(1 << 5)
+#define DIRTY_WARP		(1 << 6)
+#define DIRTY_STACKING	(1 << 7)
+#define DIRTY_MONITORS	(1 << 8)
+#define DIRTY_WORKSPACE	(1 << 9)
+
+#define ROOT_EVENT_MASK	(StructureNotifyMask | SubstructureRedirectMask | SubstructureNotifyMask | \
+                         KeyPressMask | PropertyChangeMask)
+#define STATE_VERSION	1
+
+/* optional parts of wininfo_request() */
+#define FETCH_POINTER	(1 << 0)
+#define FETCH_DESKTOP	(1 << 1)
+
 #define NUM_WORKSPACES		9
 #define WORKSPACE_NAMES		\
 	"1"					"\0"\
@@ -42,6 +70,40 @@
 	"8"					"\0"\
 	"9"					"\0"\
 
+/* indices into atoms[], interned together in setup_atoms() */
+enum {
+	NET_ACTIVE_WINDOW,
+	NET_CLIENT_LIST,
+	NET_CLIENT_LIST_STACKING,
+	NET_CURRENT_DESKTOP,
+	NET_DESKTOP_NAMES,
+	NET_NUMBER_OF_DESKTOPS,
+	NET_SUPPORTED,
+	NET_SUPPORTING_WM_CHECK,
+	NET_WM_DESKTOP,
+	NET_WM_NAME,
+	NET_WM_PING,
+	NET_WM_STATE,
+	NET_WM_STATE_FULLSCREEN,
+	NET_WM_STRUT,
+	NET_WM_STRUT_PARTIAL,
+	NET_WM_SYNC_REQUEST,
+	NET_WM_WINDOW_TYPE,
+	NET_WM_WINDOW_TYPE_DIALOG,
+	NET_WM_WINDOW_TYPE_DOCK,
+	NET_WM_WINDOW_TYPE_POPUP_MENU,
+	NET_WM_WINDOW_TYPE_SPLASH,
+	NET_WM_WINDOW_TYPE_TOOLBAR,
+	NET_WM_WINDOW_TYPE_UTILITY,
+	NET_WORKAREA,
+	SXWM_STATE,
+	UTF8_STRING,
+	WM_DELETE_WINDOW,
+	WM_PROTOCOLS,
+	WM_TAKE_FOCUS,
+	ATOM_COUNT
+};
+
 typedef enum {
 	DRAG_NONE,
 	DRAG_MOVE,
@@ -50,6 +112,34 @@ typedef enum {
 } DragMode;
 
 typedef void (*EventHandler)(XEvent *);
+typedef void (*FdHandler)(int fd);
+
+/* what a loop fd is watched for, hangups are always reported */
+enum {
+	LOOP_IN = 1 << 0,
+	LOOP_OUT = 1 << 1
+};
+
+typedef struct {
+	FdHandler fn;
+	unsigned int events;
+} LoopFd;
+
+/* event classes a control socket subscriber can ask for */
+enum {
+	EV_WORKSPACE = 1 << 0,
+	EV_FOCUS = 1 << 1,
+	EV_CLIENT = 1 << 2,
+	EV_MONITOR = 1 << 3,
+	EV_LAYOUT = 1 << 4,
+	EV_ALL = (1 << 5) - 1
+};
+
+/* deferred work run from the main loop, see timer_set() */
+enum {
+	TIMER_RELOAD,
+	TIMER_COUNT
+};
 
 typedef union {
 	const char **cmd;
@@ -64,20 +154,118 @@ typedef struct {
 	int type;
 } Binding;
 
+/* WM_PROTOCOLS a client has announced, cached in Client.protocols */
+#define PROTO_DELETE       (1 << 0)
+#define PROTO_TAKE_FOCUS   (1 << 1)
+#define PROTO_PING         (1 << 2)
+#define PROTO_SYNC_REQUEST (1 << 3)
+
+/* WM_NORMAL_HINTS, 0 for anything the client left unset */
+typedef struct {
+	int min_w, min_h;
+	int max_w, max_h;
+	int base_w, base_h;
+	int inc_w, inc_h;
+} SizeHints;
+
 typedef struct Client{
 	Window win;
 	int x, y, h, w;
 	int orig_x, orig_y, orig_w, orig_h;
 	int custom_stack_height;
+	long border_col;
 	int mon;
 	int ws;
 	Bool fixed;
 	Bool floating;
 	Bool fullscreen;
 	Bool mapped;
+	Bool map_pending;
+	Bool parked;
+	int ignore_unmap;
+	unsigned int protocols;
+	Window transient_for;
+	SizeHints hints;
 	struct Client *next;
+	struct Client *hash_next;
 } Client;
 
+typedef enum {
+	LAYOUT_TILE,
+	LAYOUT_HORIZONTAL,
+	LAYOUT_MONOCLE,
+	LAYOUT_GRID,
+	LAYOUT_COUNT
+} LayoutId;
+
+typedef struct {
+	int x, y, w, h;
+} Rect;
+
+/* everything a layout's geometry depends on, also the cache key */
+typedef struct {
+	int n;
+	int nmaster;
+	int gaps;
+	int border_width;
+	float mf;
+	Rect area;
+	const int *custom;
+} LayoutParams;
+
+typedef struct {
+	const char *name;
+	void (*arrange)(const LayoutParams *lp, Rect *out);
+} Layout;
+
+typedef struct {
+	Bool valid;
+	int layout;
+	LayoutParams key;
+	Rect *geom;
+	int geom_cap;
+	int *custom;
+	int custom_cap;
+} LayoutCache;
+
+/* _NET_WM_WINDOW_TYPE as seen by window rules, docks never reach them */
+typedef enum {
+	WIN_TYPE_NORMAL,
+	WIN_TYPE_DIALOG,
+	WIN_TYPE_UTILITY,
+	WIN_TYPE_TOOLBAR,
+	WIN_TYPE_SPLASH,
+	WIN_TYPE_POPUP_MENU,
+	WIN_TYPE_COUNT
+} WinType;
+
+typedef enum {
+	FOCUS_DEFAULT,
+	FOCUS_ALWAYS,
+	FOCUS_NEVER
+} FocusPolicy;
+
+/* a compiled window rule, NULL or -1 fields match or change nothing */
+typedef struct {
+	char *class;
+	char *instance;
+	char *title;
+	int type;
+	int ws;
+	int mon;
+	Bool floating;
+	Bool has_geom;
+	int x, y, w, h;
+	int focus;
+	int next;
+} Rule;
+
+typedef struct ClientSlab {
+	struct ClientSlab *next;
+	int n;
+	Client clients[];
+} ClientSlab;
+
 typedef struct {
 	int modkey;
 	int gaps;
@@ -85,26 +273,142 @@ typedef struct {
 	long border_foc_col;
 	long border_ufoc_col;
 	long border_swap_col;
-	float master_width[MAX_MONITORS];
+	float master_width;
 	int motion_throttle;
+	int nmaster;
+	int layout;
 	int resize_master_amt;
 	int resize_stack_amt;
 	int snap_distance;
 	int bindsn;
 	Bool new_win_focus;
 	Bool warp_cursor;
+	Bool park_hidden;
 	Binding binds[256];
-	char **should_float[256];
+	Rule *rules;
+	int rulesn;
+	int rules_cap;
+	int rule_class[RULE_BUCKETS];
+	int rule_instance[RULE_BUCKETS];
+	int rule_other;
+	Bool rule_titles;
+	char path[PATH_MAX];
     char *torun[256];
 } Config;
 
+/* per-output state survives hotplug, monitors are matched by RandR name */
 typedef struct {
+	Atom name;
 	int x, y;
 	int w, h;
+	int reserve_left, reserve_right;
+	int reserve_top, reserve_bottom;
+	int refresh;
+	float mf;
+	LayoutCache cache[NUM_WORKSPACES];
 } Monitor;
 
+/* log2 latency histogram, bucket i holds samples below 2^i microseconds */
+typedef struct {
+	unsigned long count;
+	unsigned long buckets[HIST_BUCKETS];
+	long total_us;
+	long max_us;
+} Histogram;
+
+/* counters of the metrics registry, see metrics_dump() */
+enum {
+	METRIC_TILE,
+	METRIC_CONFIGURE,
+	METRIC_BORDER,
+	METRIC_ROUNDTRIP,
+	METRIC_ATOMS,
+	METRIC_SPAWN,
+	METRIC_SPAWN_FAILED,
+	METRIC_CHILD_EXIT,
+	METRIC_CHILD_FAILED,
+	METRIC_COUNT
+};
+
+/* a client as restart() left it, see state_load() */
+typedef struct {
+	Window win;
+	int order; /* position in its workspace over all workspaces */
+	int ws, mon;
+	Bool floating;
+	Bool fullscreen;
+	int x, y, w, h;
+	int orig_x, orig_y, orig_w, orig_h;
+	int custom_stack_height;
+} SavedClient;
+
+/* growable byte buffer for socket input and output */
+typedef struct {
+	char *data;
+	int len;
+	int cap;
+} Buf;
+
+/* a connection on the control socket, indexed by its fd */
+typedef struct {
+	Bool open;
+	Buf in;
+	Buf out;
+	unsigned int events; /* nonzero once the connection has subscribed */
+} IpcConn;
+
+/* a mapped _NET_WM_WINDOW_TYPE_DOCK window and the space it reserves */
+typedef struct Dock {
+	Window win;
+	long strut[12];
+	struct Dock *next;
+} Dock;
+
+/* everything the map path needs to know about a window, fetched in one pass */
+typedef struct {
+	Window win;
+	Bool valid;
+	Bool override_redirect;
+	int map_state;
+	int x, y, w, h;
+	Bool is_dock;
+	Bool float_type;
+	int type;
+	Window transient_for;
+	unsigned int protocols;
+	SizeHints hints;
+	Bool has_pointer;
+	int ptr_x, ptr_y;
+	int desktop; /* _NET_WM_DESKTOP from a previous wm, -1 if unset or not fetched */
+	char *res_name;
+	char *res_class;
+	char *title;
+	long strut[12];
+} WinInfo;
+
+/* in-flight requests for a WinInfo, see wininfo_request() */
+typedef struct {
+	Window win;
+	xcb_get_window_attributes_cookie_t attr;
+	xcb_get_geometry_cookie_t geom;
+	xcb_get_property_cookie_t type;
+	xcb_get_property_cookie_t class;
+	xcb_get_property_cookie_t transient;
+	xcb_get_property_cookie_t hints;
+	xcb_get_property_cookie_t protocols;
+	xcb_get_property_cookie_t strut_partial;
+	xcb_get_property_cookie_t strut;
+	xcb_get_property_cookie_t net_name;
+	xcb_get_property_cookie_t name;
+	xcb_query_pointer_cookie_t pointer;
+	xcb_get_property_cookie_t desktop;
+	unsigned int want;
+	Bool want_title;
+} WinFetch;
+
 extern void close_focused(void);
 extern void dec_gaps(void);
+extern void dec_nmaster(void);
 extern void focus_next(void);
 extern void focus_prev(void);
 extern void focus_next_mon(void);
@@ -112,11 +416,15 @@ extern void focus_prev_mon(void);
 extern void move_next_mon(void);
 extern void move_prev_mon(void);
 extern void inc_gaps(void);
+extern void inc_nmaster(void);
+extern int layout_from_name(const char *name);
 extern void move_master_next(void);
 extern void move_master_prev(void);
+extern void next_layout(void);
 extern long parse_col(const char *hex);
 extern void quit(void);
 extern void reload_config(void);
+extern void restart(void);
 extern void resize_master_add(void);
 extern void resize_master_sub(void);
 extern void resize_stack_add(void);
@@ -124,3 +432,6 @@ extern void resize_stack_sub(void);
 extern void toggle_floating(void);
 extern void toggle_floating_global(void);
 extern void toggle_fullscreen(void);
+extern void toggle_grid(void);
+extern void toggle_horizontal(void);
+extern void toggle_monocle(void);
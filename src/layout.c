@@ -0,0 +1,152 @@
+/* See LICENSE for more information on use */
+/* layout arrangements, pure geometry with no X calls */
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include "layout.h"
+
+const Layout layouts[LAYOUT_COUNT] = {
+	[LAYOUT_TILE] = {"tile", layout_tile},
+	[LAYOUT_HORIZONTAL] = {"horizontal", layout_horizontal},
+	[LAYOUT_MONOCLE] = {"monocle", layout_monocle},
+	[LAYOUT_GRID] = {"grid", layout_grid},
+};
+
+int layout_from_name(const char *name)
+{
+	for (int i = 0; i < LAYOUT_COUNT; i++) {
+		if (!strcmp(name, layouts[i].name)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+void layout_grid(const LayoutParams *lp, Rect *out)
+{
+	const Rect *a = &lp->area;
+	int min_raw = 2 * lp->border_width + 1;
+	int cols = 1;
+	while (cols * cols < lp->n) {
+		cols++;
+	}
+	int rows = (lp->n + cols - 1) / cols;
+	int row_h = MAX(min_raw, (a->h - (rows - 1) * lp->gaps) / rows);
+
+	for (int r = 0; r < rows; r++) {
+		Rect *row = out + r * cols;
+		int k = MIN(cols, lp->n - r * cols);
+		int y = a->y + r * (row_h + lp->gaps);
+		/* bottom row takes whatever the division left over */
+		int h = (r == rows - 1) ? MAX(min_raw, a->y + a->h - y) : row_h;
+		for (int i = 0; i < k; i++) {
+			row[i].y = y;
+			row[i].h = h;
+		}
+		split_span(row, k, NULL, a->x, a->w, lp->gaps, min_raw, False);
+	}
+}
+
+void layout_horizontal(const LayoutParams *lp, Rect *out)
+{
+	const Rect *a = &lp->area;
+	int min_raw = 2 * lp->border_width + 1;
+	int nm = CLAMP(lp->nmaster, 0, lp->n);
+	int master_h = (nm == 0) ? 0 : (nm < lp->n) ? (int)(a->h * lp->mf) : a->h;
+	int stack_y = (nm == 0) ? a->y : a->y + master_h + lp->gaps;
+	int stack_h = (nm == 0) ? a->h : a->h - master_h - lp->gaps;
+
+	for (int i = 0; i < lp->n; i++) {
+		out[i].y = (i < nm) ? a->y : stack_y;
+		out[i].h = (i < nm) ? master_h : stack_h;
+	}
+	split_span(out, nm, NULL, a->x, a->w, lp->gaps, min_raw, False);
+	split_span(out + nm, lp->n - nm, NULL, a->x, a->w, lp->gaps, min_raw, False);
+}
+
+void layout_monocle(const LayoutParams *lp, Rect *out)
+{
+	for (int i = 0; i < lp->n; i++) {
+		out[i] = lp->area;
+	}
+}
+
+void layout_tile(const LayoutParams *lp, Rect *out)
+{
+	const Rect *a = &lp->area;
+	int min_raw = 2 * lp->border_width + 1;
+	int nm = CLAMP(lp->nmaster, 0, lp->n);
+	int master_w = (nm == 0) ? 0 : (nm < lp->n) ? (int)(a->w * lp->mf) : a->w;
+	int stack_x = (nm == 0) ? a->x : a->x + master_w + lp->gaps;
+	int stack_w = (nm == 0) ? a->w : a->w - master_w - lp->gaps;
+
+	for (int i = 0; i < lp->n; i++) {
+		out[i].x = (i < nm) ? a->x : stack_x;
+		out[i].w = (i < nm) ? master_w : stack_w;
+	}
+	/* only stack windows honour custom heights */
+	split_span(out, nm, NULL, a->y, a->h, lp->gaps, min_raw, True);
+	split_span(out + nm, lp->n - nm, lp->custom ? lp->custom + nm : NULL, a->y, a->h, lp->gaps, min_raw, True);
+}
+
+void split_span(Rect *out, int n, const int *custom, int start, int span, int gap, int min_raw, Bool vertical)
+{
+	if (n <= 0) {
+		return;
+	}
+
+	int total_fixed = 0, auto_count = 0;
+	for (int i = 0; i < n; i++) {
+		if (custom && custom[i] > 0) {
+			total_fixed += custom[i];
+		}
+		else {
+			auto_count++;
+		}
+	}
+
+	int total_gaps = (n - 1) * gap;
+	int remaining = span - total_fixed - total_gaps;
+	int auto_sz = (auto_count > 0 && remaining >= auto_count * min_raw) ? remaining / auto_count : 0;
+	int used = 0, count = 0, total = total_gaps;
+
+	for (int i = 0; i < n; i++) {
+		int *sz = vertical ? &out[i].h : &out[i].w;
+		if (custom && custom[i] > 0) {
+			*sz = custom[i];
+		}
+		else if (auto_sz) {
+			count++;
+			*sz = (count < auto_count) ? auto_sz : remaining - used;
+			used += auto_sz;
+		}
+		else {
+			*sz = min_raw;
+		}
+		total += *sz;
+	}
+
+	/* shrink from the start if overfilled, excluding the last */
+	for (int i = 0; i < n - 1 && total > span; i++) {
+		int *sz = vertical ? &out[i].h : &out[i].w;
+		int shrink = MIN(total - span, *sz - min_raw);
+		*sz -= shrink;
+		total -= shrink;
+	}
+
+	/* if its not perfectly filled stretch the last to absorb remainder */
+	if (total < span) {
+		*(vertical ? &out[n - 1].h : &out[n - 1].w) += span - total;
+	}
+
+	int pos = start;
+	for (int i = 0; i < n; i++) {
+		if (vertical) {
+			out[i].y = pos;
+			pos += out[i].h + gap;
+		}
+		else {
+			out[i].x = pos;
+			pos += out[i].w + gap;
+		}
+	}
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include "defs.h"
+
+extern const Layout layouts[LAYOUT_COUNT];
+
+void layout_grid(const LayoutParams *lp, Rect *out);
+void layout_horizontal(const LayoutParams *lp, Rect *out);
+void layout_monocle(const LayoutParams *lp, Rect *out);
+void layout_tile(const LayoutParams *lp, Rect *out);
+void split_span(Rect *out, int n, const int *custom, int start, int span, int gap, int min_raw, Bool vertical);
@@ -13,8 +13,6 @@
 #include "parser.h"
 #include "defs.h"
 
-extern void toggle_horizontal(void); // New: Horizontal layout
-
 static const struct {
     const char *name;
     void (*fn)(void);
@@ -32,6 +30,7 @@ static const struct {
     {"move_prev_mon", move_prev_mon},
     {"quit", quit},
     {"reload_config", reload_config},
+    {"restart", restart},
     {"master_increase", resize_master_add},
     {"master_decrease", resize_master_sub},
     {"stack_increase", resize_stack_add},
@@ -39,10 +38,35 @@ static const struct {
     {"toggle_floating", toggle_floating},
     {"global_floating", toggle_floating_global},
     {"fullscreen", toggle_fullscreen},
-    {"horizontal", toggle_horizontal}, // New: Horizontal layout
+    {"horizontal", toggle_horizontal},
+    {"monocle", toggle_monocle},
+    {"grid", toggle_grid},
+    {"next_layout", next_layout},
+    {"master_count_increase", inc_nmaster},
+    {"master_count_decrease", dec_nmaster},
     {NULL, NULL}
 };
 
+static const char *win_type_names[WIN_TYPE_COUNT] = {
+    [WIN_TYPE_NORMAL] = "normal",
+    [WIN_TYPE_DIALOG] = "dialog",
+    [WIN_TYPE_UTILITY] = "utility",
+    [WIN_TYPE_TOOLBAR] = "toolbar",
+    [WIN_TYPE_SPLASH] = "splash",
+    [WIN_TYPE_POPUP_MENU] = "popup_menu",
+};
+
+/* also used by the control socket, so every bindable function can be called from it */
+void (*action_from_name(const char *name))(void)
+{
+    for (int i = 0; call_table[i].name; i++) {
+        if (!strcmp(name, call_table[i].name)) {
+            return call_table[i].fn;
+        }
+    }
+    return NULL;
+}
+
 static void remap_and_dedupe_binds(Config *cfg)
 {
     for (int i = 0; i < cfg->bindsn; i++) {
@@ -81,6 +105,218 @@ static char *strip_quotes(char *s)
     return s;
 }
 
+/* like strchr, but skips anything between double quotes */
+static char *find_unquoted(char *s, char c)
+{
+    Bool quoted = False;
+    for (; *s; s++) {
+        if (*s == '"') {
+            quoted = !quoted;
+        }
+        else if (*s == c && !quoted) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+/* next space separated word, a quoted part may contain spaces */
+static char *next_word(char **p)
+{
+    char *s = *p;
+    while (*s && isspace((unsigned char)*s)) {
+        s++;
+    }
+    if (!*s) {
+        *p = s;
+        return NULL;
+    }
+
+    char *start = s;
+    Bool quoted = False;
+    while (*s && (quoted || !isspace((unsigned char)*s))) {
+        if (*s == '"') {
+            quoted = !quoted;
+        }
+        s++;
+    }
+    if (*s) {
+        *s++ = '\0';
+    }
+    *p = s;
+    return start;
+}
+
+static Rule *alloc_rule(Config *cfg)
+{
+    if (cfg->rulesn >= cfg->rules_cap) {
+        int cap = cfg->rules_cap ? cfg->rules_cap * 2 : 16;
+        Rule *tmp = realloc(cfg->rules, cap * sizeof *tmp);
+        if (!tmp) {
+            return NULL;
+        }
+        cfg->rules = tmp;
+        cfg->rules_cap = cap;
+    }
+    return &cfg->rules[cfg->rulesn++];
+}
+
+/* rule: <matchers> : <actions>, see sxwm(1). 1 on a syntax error, -1 when out of memory */
+static int parse_rule(Config *cfg, char *rest, int lineno)
+{
+    Rule r = {.type = -1, .ws = -1, .mon = -1, .next = -1};
+    const char *class = NULL, *instance = NULL, *title = NULL;
+
+    char *mid = find_unquoted(rest, ':');
+    if (!mid) {
+        fprintf(stderr, "sxwmrc:%d: rule missing action\n", lineno);
+        return 1;
+    }
+    *mid = '\0';
+    char *acts = mid + 1;
+    char *comment = find_unquoted(acts, '#');
+    if (comment) {
+        *comment = '\0';
+    }
+
+    char *p = rest;
+    for (char *tok = next_word(&p); tok; tok = next_word(&p)) {
+        char *eq = strchr(tok, '=');
+        if (!eq) {
+            fprintf(stderr, "sxwmrc:%d: bad rule matcher '%s'\n", lineno, tok);
+            return 1;
+        }
+        *eq = '\0';
+        char *val = strip_quotes(eq + 1);
+
+        if (!strcmp(tok, "class")) {
+            class = val;
+        }
+        else if (!strcmp(tok, "instance")) {
+            instance = val;
+        }
+        else if (!strcmp(tok, "title")) {
+            title = val;
+        }
+        else if (!strcmp(tok, "type")) {
+            for (int i = 0; i < WIN_TYPE_COUNT; i++) {
+                if (!strcmp(val, win_type_names[i])) {
+                    r.type = i;
+                    break;
+                }
+            }
+            if (r.type < 0) {
+                fprintf(stderr, "sxwmrc:%d: unknown window type '%s'\n", lineno, val);
+                return 1;
+            }
+        }
+        else {
+            fprintf(stderr, "sxwmrc:%d: unknown rule matcher '%s'\n", lineno, tok);
+            return 1;
+        }
+    }
+
+    if (!class && !instance && !title && r.type < 0) {
+        fprintf(stderr, "sxwmrc:%d: rule has no matcher\n", lineno);
+        return 1;
+    }
+
+    int bad = 0;
+    char *act_ptr;
+    for (char *act = strtok_r(acts, ",", &act_ptr); act; act = strtok_r(NULL, ",", &act_ptr)) {
+        act = strip(act);
+        int n;
+        if (sscanf(act, "float %d %d %d %d", &r.x, &r.y, &r.w, &r.h) == 4 && r.w > 0 && r.h > 0) {
+            r.floating = True;
+            r.has_geom = True;
+        }
+        else if (!strcmp(act, "float")) {
+            r.floating = True;
+        }
+        else if (sscanf(act, "workspace %d", &n) == 1 && n >= 1 && n <= NUM_WORKSPACES) {
+            r.ws = n - 1;
+        }
+        else if (sscanf(act, "monitor %d", &n) == 1 && n >= 1) {
+            r.mon = n - 1;
+        }
+        else if (!strcmp(act, "focus true")) {
+            r.focus = FOCUS_ALWAYS;
+        }
+        else if (!strcmp(act, "focus false")) {
+            r.focus = FOCUS_NEVER;
+        }
+        else if (*act) {
+            fprintf(stderr, "sxwmrc:%d: invalid rule action '%s'\n", lineno, act);
+            bad = 1;
+        }
+    }
+
+    Rule *out = alloc_rule(cfg);
+    if (!out) {
+        return -1;
+    }
+    *out = r;
+    out->class = class ? strdup(class) : NULL;
+    out->instance = instance ? strdup(instance) : NULL;
+    out->title = title ? strdup(title) : NULL;
+    if ((class && !out->class) || (instance && !out->instance) || (title && !out->title)) {
+        return -1;
+    }
+    if (title) {
+        cfg->rule_titles = True;
+    }
+    return bad;
+}
+
+/* should_float is shorthand for a float rule on the class and one on the instance */
+static int add_float_rule(Config *cfg, const char *name)
+{
+    for (int i = 0; i < 2; i++) {
+        Rule *r = alloc_rule(cfg);
+        if (!r) {
+            return -1;
+        }
+        *r = (Rule){.type = -1, .ws = -1, .mon = -1, .floating = True, .next = -1};
+        char *dup = strdup(name);
+        if (!dup) {
+            return -1;
+        }
+        if (i == 0) {
+            r->class = dup;
+        }
+        else {
+            r->instance = dup;
+        }
+    }
+    return 0;
+}
+
+/* chain rules into per-class and per-instance buckets, earlier rules first */
+static void compile_rules(Config *cfg)
+{
+    for (int i = 0; i < RULE_BUCKETS; i++) {
+        cfg->rule_class[i] = -1;
+        cfg->rule_instance[i] = -1;
+    }
+    cfg->rule_other = -1;
+
+    for (int i = cfg->rulesn - 1; i >= 0; i--) {
+        Rule *r = &cfg->rules[i];
+        int *head;
+        if (r->class) {
+            head = &cfg->rule_class[rule_hash(r->class) % RULE_BUCKETS];
+        }
+        else if (r->instance) {
+            head = &cfg->rule_instance[rule_hash(r->instance) % RULE_BUCKETS];
+        }
+        else {
+            head = &cfg->rule_other;
+        }
+        r->next = *head;
+        *head = i;
+    }
+}
+
 static Binding *alloc_bind(Config *cfg, unsigned mods, KeySym ks)
 {
     for (int i = 0; i < cfg->bindsn; i++) {
@@ -134,45 +370,49 @@ static unsigned parse_combo(const char *combo, Config *cfg, KeySym *out_ks)
     return m;
 }
 
-int parser(Config *cfg)
+/* every place a config file is looked for, most preferred first */
+int config_paths(char (*paths)[PATH_MAX])
 {
-    char path[PATH_MAX];
+    int n = 0;
     const char *home = getenv("HOME");
-    if (!home) {
+    const char *xdg_config_home = getenv("XDG_CONFIG_HOME");
+    if (xdg_config_home) {
+        snprintf(paths[n++], PATH_MAX, "%s/sxwmrc", xdg_config_home);
+        snprintf(paths[n++], PATH_MAX, "%s/sxwm/sxwmrc", xdg_config_home);
+    }
+    if (home) {
+        snprintf(paths[n++], PATH_MAX, "%s/.config/sxwmrc", home);
+    }
+    snprintf(paths[n++], PATH_MAX, "/usr/local/share/sxwmrc");
+    return n;
+}
+
+/* -1 if the config could not be read at all, otherwise the number of errors in it */
+int parser(Config *cfg)
+{
+    char paths[CONFIG_PATHS][PATH_MAX];
+    if (!getenv("HOME")) {
         fputs("sxwmrc: HOME not set\n", stderr);
         return -1;
     }
 
     /* determine config file path */
-    const char *xdg_config_home = getenv("XDG_CONFIG_HOME");
-    if (xdg_config_home) {
-        snprintf(path, sizeof path, "%s/sxwmrc", xdg_config_home);
-        if (access(path, R_OK) == 0) {
-            goto found;
+    int n = config_paths(paths);
+    int found = -1;
+    for (int i = 0; i < n && found < 0; i++) {
+        if (access(paths[i], R_OK) == 0) {
+            found = i;
         }
-
-        snprintf(path, sizeof path, "%s/sxwm/sxwmrc", xdg_config_home);
-        if (access(path, R_OK) == 0) {
-            goto found;
-        }
-    }
-
-    snprintf(path, sizeof path, "%s/.config/sxwmrc", home);
-    if (access(path, R_OK) == 0) {
-        goto found;
     }
 
-    snprintf(path, sizeof path, "/usr/local/share/sxwmrc");
-    if (access(path, R_OK) == 0) {
-        goto found;
+    if (found < 0) {
+        fprintf(stderr, "sxwmrc: no configuration file found\n");
+        return -1;
     }
 
-    /* Nothing found */
-    fprintf(stderr, "sxwmrc: no configuration file found\n");
-    return -1;
-
-found:
+    const char *path = paths[found];
     printf("sxwmrc: using configuration file %s\n", path);
+    memcpy(cfg->path, paths[found], sizeof cfg->path);
     FILE *f = fopen(path, "r");
     if (!f) {
         fprintf(stderr, "sxwmrc: cannot open %s\n", path);
@@ -181,18 +421,8 @@ found:
 
     char line[512];
     int lineno = 0;
-    int should_floatn = 0;
     int torun = 0;
-
-    /* Initialize should_float matrix */
-    for (int j = 0; j < 256; j++) {
-        cfg->should_float[j] = calloc(1, sizeof(char *));
-        if (!cfg->should_float[j]) {
-            fprintf(stderr, "calloc failed\n");
-            fclose(f);
-            return -1;
-        }
-    }
+    int settings = 0, errors = 0;
 
     while (fgets(line, sizeof line, f)) {
         lineno++;
@@ -200,10 +430,12 @@ found:
         if (!*s || *s == '#') {
             continue;
         }
+        settings++;
 
         char *sep = strchr(s, ':');
         if (!sep) {
             fprintf(stderr, "sxwmrc:%d: missing ':'\n", lineno);
+            errors++;
             continue;
         }
 
@@ -218,6 +450,7 @@ found:
             }
             else {
                 fprintf(stderr, "sxwmrc:%d: unknown mod_key '%s'\n", lineno, rest);
+                errors++;
             }
         }
         else if (!strcmp(key, "gaps")) {
@@ -241,10 +474,28 @@ found:
         else if (!strcmp(key, "warp_cursor")) {
             cfg->warp_cursor = !strcmp(rest, "true") ? True : False;
         }
+        else if (!strcmp(key, "park_hidden_windows")) {
+            cfg->park_hidden = !strcmp(rest, "true") ? True : False;
+        }
         else if (!strcmp(key, "master_width")) {
-            float mf = (float)atoi(rest) / 100.0f;
-            for (int i = 0; i < MAX_MONITORS; i++) {
-                cfg->master_width[i] = mf;
+            cfg->master_width = (float)atoi(rest) / 100.0f;
+        }
+        else if (!strcmp(key, "master_count")) {
+            cfg->nmaster = MAX(0, atoi(rest));
+        }
+        else if (!strcmp(key, "layout")) {
+            char *comment = strchr(rest, '#');
+            if (comment) {
+                *comment = '\0';
+                rest = strip(rest);
+            }
+            int l = layout_from_name(rest);
+            if (l < 0) {
+                fprintf(stderr, "sxwmrc:%d: unknown layout '%s'\n", lineno, rest);
+                errors++;
+            }
+            else {
+                cfg->layout = l;
             }
         }
         else if (!strcmp(key, "motion_throttle")) {
@@ -260,11 +511,6 @@ found:
             cfg->snap_distance = atoi(rest);
         }
         else if (!strcmp(key, "should_float")) {
-            if (should_floatn >= 256) {
-                fprintf(stderr, "sxwmrc:%d: too many should_float entries\n", lineno);
-                continue;
-            }
-
             char *comment = strchr(rest, '#');
             size_t len = comment ? (size_t)(comment - rest) : strlen(rest);
             if (len >= sizeof(line)) {
@@ -278,8 +524,8 @@ found:
             char *comma_ptr;
             char *comma = strtok_r(final, ",", &comma_ptr);
 
-            /* store each comma separated value in a separate row */
-            while (comma && should_floatn < 256) {
+            /* each comma separated value becomes its own rule */
+            while (comma) {
                 comma = strip(comma);
                 if (*comma == '"') {
                     comma++;
@@ -289,22 +535,26 @@ found:
                     *end = '\0';
                 }
 
-                char *dup = strdup(comma);
-                if (!dup) {
+                if (add_float_rule(cfg, comma)) {
                     fprintf(stderr, "sxwmrc:%d: failed to allocate memory\n", lineno);
                     goto cleanup_file;
                 }
-
-                /* store each program's name in its own row at index 0 */
-                cfg->should_float[should_floatn][0] = dup;
-                should_floatn++;
                 comma = strtok_r(NULL, ",", &comma_ptr);
             }
         }
+        else if (!strcmp(key, "rule")) {
+            int r = parse_rule(cfg, rest, lineno);
+            if (r < 0) {
+                fprintf(stderr, "sxwmrc:%d: failed to allocate memory\n", lineno);
+                goto cleanup_file;
+            }
+            errors += r;
+        }
         else if (!strcmp(key, "call") || !strcmp(key, "bind")) {
             char *mid = strchr(rest, ':');
             if (!mid) {
                 fprintf(stderr, "sxwmrc:%d: '%s' missing action\n", lineno, key);
+                errors++;
                 continue;
             }
             *mid = '\0';
@@ -315,6 +565,7 @@ found:
             unsigned mods = parse_combo(combo, cfg, &ks);
             if (ks == NoSymbol) {
                 fprintf(stderr, "sxwmrc:%d: bad key in '%s'\n", lineno, combo);
+                errors++;
                 continue;
             }
 
@@ -329,21 +580,16 @@ found:
                 b->action.cmd = build_argv(strip_quotes(act));
                 if (!b->action.cmd) {
                     fprintf(stderr, "sxwmrc:%d: failed to parse command: %s\n", lineno, act);
+                    errors++;
                     b->type = -1;
                 }
             }
             else {
                 b->type = TYPE_FUNC;
-                Bool found = False;
-                for (int i = 0; call_table[i].name; i++) {
-                    if (!strcmp(act, call_table[i].name)) {
-                        b->action.fn = call_table[i].fn;
-                        found = True;
-                        break;
-                    }
-                }
-                if (!found) {
+                b->action.fn = action_from_name(act);
+                if (!b->action.fn) {
                     fprintf(stderr, "sxwmrc:%d: unknown function '%s'\n", lineno, act);
+                    errors++;
                 }
             }
         }
@@ -351,6 +597,7 @@ found:
             char *mid = strchr(rest, ':');
             if (!mid) {
                 fprintf(stderr, "sxwmrc:%d: workspace missing action\n", lineno);
+                errors++;
                 continue;
             }
             *mid = '\0';
@@ -361,12 +608,14 @@ found:
             unsigned mods = parse_combo(combo, cfg, &ks);
             if (ks == NoSymbol) {
                 fprintf(stderr, "sxwmrc:%d: bad key in '%s'\n", lineno, combo);
+                errors++;
                 continue;
             }
 
             Binding *b = alloc_bind(cfg, mods, ks);
             if (!b) {
                 fputs("sxwm: too many binds\n", stderr);
+                errors++;
                 break;
             }
 
@@ -381,11 +630,13 @@ found:
             }
             else {
                 fprintf(stderr, "sxwmrc:%d: invalid workspace action '%s'\n", lineno, act);
+                errors++;
             }
         }
         else if (!strcmp(key, "exec")) {
             if (torun >= 256) {
                 fprintf(stderr, "sxwmrc:%d: too many exec commands\n", lineno);
+                errors++;
                 continue;
             }
 
@@ -399,6 +650,7 @@ found:
 
             if (!*cmd) {
                 fprintf(stderr, "sxwmrc:%d: empty exec command\n", lineno);
+                errors++;
                 continue;
             }
 
@@ -411,29 +663,45 @@ found:
         }
         else {
             fprintf(stderr, "sxwmrc:%d: unknown option '%s'\n", lineno, key);
+            errors++;
         }
     }
 
     fclose(f);
+    if (!settings) {
+        fprintf(stderr, "sxwmrc: %s has no settings\n", path);
+        errors++;
+    }
     remap_and_dedupe_binds(cfg);
-    return 0;
+    compile_rules(cfg);
+    return errors;
 
 cleanup_file:
     if (f) {
         fclose(f);
     }
-    for (int j = 0; j < 256; j++) {
-        if (cfg->should_float[j]) {
-            free(cfg->should_float[j][0]);
-            free(cfg->should_float[j]);
-        }
-    }
+    free_rules(cfg);
     for (int i = 0; i < torun; i++) {
         free(cfg->torun[i]);
+        cfg->torun[i] = NULL;
     }
     return -1;
 }
 
+void free_rules(Config *cfg)
+{
+    for (int i = 0; i < cfg->rulesn; i++) {
+        free(cfg->rules[i].class);
+        free(cfg->rules[i].instance);
+        free(cfg->rules[i].title);
+    }
+    free(cfg->rules);
+    cfg->rules = NULL;
+    cfg->rulesn = 0;
+    cfg->rules_cap = 0;
+    cfg->rule_titles = False;
+}
+
 int parse_mods(const char *mods, Config *cfg)
 {
     KeySym dummy;
@@ -580,3 +848,14 @@ const char **build_argv(const char *cmd)
     return argv;
 #endif
 }
+
+/* FNV-1a, shared by compile_rules() and the lookup at map time */
+unsigned int rule_hash(const char *s)
+{
+    unsigned int h = 2166136261u;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 16777619u;
+    }
+    return h;
+}
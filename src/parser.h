@@ -1,8 +1,13 @@
 #pragma once
 #include "defs.h"
 #define MAX_ARGS 64
+#define CONFIG_PATHS 4
 
+void (*action_from_name(const char *name))(void);
 const char **build_argv(const char *cmd);
+int config_paths(char (*paths)[PATH_MAX]);
+void free_rules(Config *cfg);
 int parser(Config *user_config);
 int parse_mods(const char *mods, Config *user_config);
-KeySym parse_keysym(const char *key);
\ No newline at end of file
+KeySym parse_keysym(const char *key);
+unsigned int rule_hash(const char *s);
@@ -14,106 +14,254 @@
  *	  (C) Abhinav Prasai 2025
  */
 
+#define _POSIX_C_SOURCE 200809L
 #include <X11/X.h>
+#include <ctype.h>
 #include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <limits.h>
+#include <poll.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#endif
 
 #include <X11/Xatom.h>
-#include <X11/XKBlib.h>
 #include <X11/Xlib.h>
+#include <X11/Xlib-xcb.h>
+#include <X11/Xlibint.h>
 #include <X11/Xproto.h>
 #include <X11/Xutil.h>
 
-#include <X11/extensions/Xinerama.h>
+#include <X11/extensions/Xrandr.h>
 #include <X11/Xcursor/Xcursor.h>
 
 #include "defs.h"
+#include "layout.h"
 #include "parser.h"
 
-Client *add_client(Window w, int ws);
+Client *add_client(WinInfo *wi, int ws);
+void buf_append(Buf *b, const char *data, int len);
+void buf_printf(Buf *b, const char *fmt, ...);
+void build_key_dispatch(short (*table)[KEY_MODS]);
 void change_workspace(int ws);
 int clean_mask(int mask);
+Client *client_alloc(void);
+void client_index_add(Client *c);
+void client_index_remove(Client *c);
+void client_list_add(Client *c);
+void client_list_remove(Window w);
+void client_refresh_property(Client *c, Atom atom);
+void client_release(Client *c);
 /* void close_focused(void); */
+void count_requests(Display *d, XExtCodes *codes, const char *data, long len);
 /* void dec_gaps(void); */
+/* void dec_nmaster(void); */
+void dock_add(WinInfo *wi);
+Dock *dock_find(Window w);
+Bool dock_remove(Window w);
+void dock_update_strut(Dock *d);
+Cursor drag_cursor(Bool move);
+void drag_to(int x_root, int y_root, Window child);
 void startup_exec(void);
+Client *find_client(Window w);
 Window find_toplevel(Window w);
+void flush_dirty(void);
+void free_binds(Config *cfg);
 /* void focus_next(void); */
 /* void focus_prev(void); */
 int get_monitor_for(Client *c);
+void grab_buttons(Window w, int mod);
+void grab_key(int kc, int m, Bool grab);
 void grab_keys(void);
+Bool grow_array(void **arr, int *cap, int need, size_t size);
+void handle_signal(int signo);
 void hdl_button(XEvent *xev);
+void hide_client(Client *c);
 void hdl_button_release(XEvent *xev);
 void hdl_client_msg(XEvent *xev);
+void hdl_config_watch(int fd);
+void hdl_ipc_accept(int fd);
+void hdl_ipc_read(int fd);
+void hdl_ipc_sub(int fd);
 void hdl_config_ntf(XEvent *xev);
 void hdl_config_req(XEvent *xev);
 void hdl_dummy(XEvent *xev);
 void hdl_destroy_ntf(XEvent *xev);
 void hdl_keypress(XEvent *xev);
+void hdl_map_ntf(XEvent *xev);
 void hdl_map_req(XEvent *xev);
+void hdl_mapping_ntf(XEvent *xev);
+void hdl_randr(XEvent *xev);
 void hdl_motion(XEvent *xev);
-void hdl_root_property(XEvent *xev);
+void hdl_property(XEvent *xev);
+void hdl_signal(int fd);
+void hdl_timer(int fd);
 void hdl_unmap_ntf(XEvent *xev);
+void hdl_xconn(int fd);
+void hist_add(Histogram *h, long us);
+long hist_quantile(const Histogram *h, int permille);
 /* void inc_gaps(void); */
+/* void inc_nmaster(void); */
 void init_defaults(void);
+void ipc_cleanup(void);
+void ipc_client_event(const char *what, Client *c);
+void ipc_close(int fd);
+void ipc_event(unsigned int ev, const char *fmt, ...);
+void ipc_exec(char *cmd, Buf *out);
+void ipc_flush(void);
+void ipc_query(const char *what, Buf *out);
+void ipc_reply(int fd, const char *data, int len);
+void ipc_run(int fd);
+void ipc_set(char *arg, Buf *out);
+void ipc_socket_path(char *out, size_t n);
+void ipc_state_events(void);
+unsigned int ipc_subscribe(char *arg, Buf *out);
+void ipc_sub_write(int fd);
+const Rect *layout_arrange(int ws, int m, int layout, const LayoutParams *lp);
+void loop_add(int fd, FdHandler fn);
+void loop_remove(int fd);
+void loop_set(int fd, FdHandler fn, unsigned int events);
+void loop_wait(void);
+Client *manage_window(WinInfo *wi, Bool adopt);
+void mark_dirty(unsigned int flags);
+void metrics_dump(Buf *b);
+long now_ms(void);
+long now_us(void);
+int mod_index(int mask);
+int mod_mask(int index);
 /* void move_master_next(void); */
 /* void move_master_prev(void); */
+Time motion_interval(int x, int y);
 void move_to_workspace(int ws);
+/* void next_layout(void); */
 void other_wm(void);
 int other_wm_err(Display *dpy, XErrorEvent *ee);
 /* long parse_col(const char *hex); */
 /* void quit(void); */
 /* void reload_config(void); */
+/* void restart(void); */
 /* void resize_master_add(void); */
 /* void resize_master_sub(void); */
 /* void resize_stack_add(void); */
 /* void resize_stack_sub(void); */
+unsigned int protocols_from_reply(xcb_get_property_reply_t *r);
+void raise_client(Client *c);
+void regrab_keys(void);
+int rule_chain_match(int i, const WinInfo *wi, int best);
+const Rule *rule_match(const WinInfo *wi);
+Bool rule_matches(const Rule *r, const WinInfo *wi);
 void run(void);
 void scan_existing_windows(void);
-void send_wm_take_focus(Window w);
+void send_wm_take_focus(Client *c);
+void set_border(Client *c, long col);
+void set_layout(int layout);
+void size_hints_apply(const SizeHints *sh, int *w, int *h);
+void size_hints_from_reply(xcb_get_property_reply_t *r, SizeHints *sh);
 void setup(void);
+void setup_cursor(void);
+void setup_ipc(void);
+void setup_loop(void);
+void show_client(Client *c);
+void show_workspace(int from);
+void signal_to_pipe(int signo);
 void setup_atoms(void);
-Bool window_should_float(Window w);
 void spawn(const char **argv);
+int saved_cmp(const void *a, const void *b);
+const SavedClient *state_find(Window w);
+Bool state_load(void);
+void state_restore_order(void);
+void state_save(Buf *b);
 void swap_clients(Client *a, Client *b);
 void tile(void);
+void timer_arm(void);
+void timer_set(int id, long delay_ms);
+void timers_run(void);
+void trace_phase(const char *phase);
 /* void toggle_floating(void); */
 /* void toggle_floating_global(void); */
 /* void toggle_fullscreen(void); */
+/* void toggle_grid(void); */
+/* void toggle_horizontal(void); */
+/* void toggle_monocle(void); */
+void ungrab_buttons(Window w, int mod);
 void update_borders(void);
-void update_client_desktop_properties(void);
+void update_client_desktop(Client *c);
 void update_monitors(void);
 void update_net_client_list(void);
+void update_refresh_rates(void);
+void update_net_client_stacking(void);
 void update_struts(void);
 void update_workarea(void);
+void strut_from_replies(xcb_get_property_reply_t *partial, xcb_get_property_reply_t *legacy, long *strut);
+Window transient_from_reply(xcb_get_property_reply_t *r);
 void warp_cursor(Client *c);
+void watch_config(void);
+void wininfo_collect(WinFetch *wf, WinInfo *wi);
+void wininfo_free(WinInfo *wi);
+void wininfo_request(Window w, unsigned int want, WinFetch *wf);
 int xerr(Display *dpy, XErrorEvent *ee);
 void xev_case(XEvent *xev);
 #include "config.h"
 
-Atom atom_net_active_window;
-Atom atom_net_current_desktop;
-Atom atom_net_supported;
-Atom atom_net_wm_state;
-Atom atom_net_wm_state_fullscreen;
-Atom atom_wm_window_type;
-Atom atom_net_wm_window_type_dock;
-Atom atom_net_workarea;
-Atom atom_wm_delete;
-Atom atom_wm_strut;
-Atom atom_wm_strut_partial;
-Atom atom_net_supporting_wm_check;
-Atom atom_net_wm_name;
-Atom atom_utf8_string;
-Atom atom_net_wm_desktop;
-Atom atom_net_client_list;
-
-Cursor c_normal, c_move, c_resize;
+Atom atoms[ATOM_COUNT];
+const char *atom_names[ATOM_COUNT] = {
+	[NET_ACTIVE_WINDOW] = "_NET_ACTIVE_WINDOW",
+	[NET_CLIENT_LIST] = "_NET_CLIENT_LIST",
+	[NET_CLIENT_LIST_STACKING] = "_NET_CLIENT_LIST_STACKING",
+	[NET_CURRENT_DESKTOP] = "_NET_CURRENT_DESKTOP",
+	[NET_DESKTOP_NAMES] = "_NET_DESKTOP_NAMES",
+	[NET_NUMBER_OF_DESKTOPS] = "_NET_NUMBER_OF_DESKTOPS",
+	[NET_SUPPORTED] = "_NET_SUPPORTED",
+	[NET_SUPPORTING_WM_CHECK] = "_NET_SUPPORTING_WM_CHECK",
+	[NET_WM_DESKTOP] = "_NET_WM_DESKTOP",
+	[NET_WM_NAME] = "_NET_WM_NAME",
+	[NET_WM_PING] = "_NET_WM_PING",
+	[NET_WM_STATE] = "_NET_WM_STATE",
+	[NET_WM_STATE_FULLSCREEN] = "_NET_WM_STATE_FULLSCREEN",
+	[NET_WM_STRUT] = "_NET_WM_STRUT",
+	[NET_WM_STRUT_PARTIAL] = "_NET_WM_STRUT_PARTIAL",
+	[NET_WM_SYNC_REQUEST] = "_NET_WM_SYNC_REQUEST",
+	[NET_WM_WINDOW_TYPE] = "_NET_WM_WINDOW_TYPE",
+	[NET_WM_WINDOW_TYPE_DIALOG] = "_NET_WM_WINDOW_TYPE_DIALOG",
+	[NET_WM_WINDOW_TYPE_DOCK] = "_NET_WM_WINDOW_TYPE_DOCK",
+	[NET_WM_WINDOW_TYPE_POPUP_MENU] = "_NET_WM_WINDOW_TYPE_POPUP_MENU",
+	[NET_WM_WINDOW_TYPE_SPLASH] = "_NET_WM_WINDOW_TYPE_SPLASH",
+	[NET_WM_WINDOW_TYPE_TOOLBAR] = "_NET_WM_WINDOW_TYPE_TOOLBAR",
+	[NET_WM_WINDOW_TYPE_UTILITY] = "_NET_WM_WINDOW_TYPE_UTILITY",
+	[NET_WORKAREA] = "_NET_WORKAREA",
+	[SXWM_STATE] = "_SXWM_STATE",
+	[UTF8_STRING] = "UTF8_STRING",
+	[WM_DELETE_WINDOW] = "WM_DELETE_WINDOW",
+	[WM_PROTOCOLS] = "WM_PROTOCOLS",
+	[WM_TAKE_FOCUS] = "WM_TAKE_FOCUS",
+};
+unsigned long startup_atom_requests = 0;
+
+Bool adopting = False;
+char **restart_argv = NULL;
+/* state handed over by restart(), only alive during scan_existing_windows() */
+SavedClient *saved = NULL;
+int savedn = 0;
+Window saved_focus = None;
+Cursor c_normal, c_move, c_resize; /* None until first needed, see drag_cursor() */
+Bool startup_trace = False;
+long trace_last = 0;
 Client *workspaces[NUM_WORKSPACES] = {NULL};
 Config default_config;
 Config user_config;
@@ -124,33 +272,121 @@ Client *swap_target = NULL;
 Client *focused = NULL;
 EventHandler evtable[LASTEvent];
 Display *dpy;
+xcb_connection_t *xconn;
 Window root;
 Window wm_check_win;
 Monitor *mons = NULL;
 int monsn = 0;
 int current_monitor = 0;
 Bool global_floating = False;
-Bool in_ws_switch = False;
 Bool backup_binds = False;
 Bool running = False;
 
-long last_motion_time = 0;
+Time last_motion_time = 0;
+Bool randr_ok = False;
+int randr_event_base = 0;
 int scr_width;
 int scr_height;
 int open_windows = 0;
 int drag_start_x, drag_start_y;
 int drag_orig_x, drag_orig_y, drag_orig_w, drag_orig_h;
 
-int reserve_left = 0;
-int reserve_right = 0;
-int reserve_top = 0;
-int reserve_bottom = 0;
+Dock *docks = NULL;
+
+/* Window -> Client for every managed window on every workspace */
+Client **client_index = NULL;
+unsigned int client_index_size = 0;
+unsigned int client_index_count = 0;
+
+/* clients are carved out of slabs and recycled through a free list */
+ClientSlab *client_slabs = NULL;
+Client *client_free = NULL;
+int client_slab_total = 0;
+
+/* scratch buffers reused by every layout pass */
+Client **tile_order = NULL;
+int tile_order_cap = 0;
+int *tile_heights = NULL;
+int tile_heights_cap = 0;
+int *tile_mon = NULL;
+int tile_mon_cap = 0;
+Window *client_list = NULL;
+int client_list_n = 0;
+int client_list_cap = 0;
+Window *stack_list = NULL;
+int stack_list_n = 0;
+int stack_list_cap = 0;
+
+int ws_layout[NUM_WORKSPACES];
+int ws_nmaster[NUM_WORKSPACES];
+
+/* inotify on every directory a config could be found in, see watch_config() */
+int config_watch_fd = -1;
+int config_watch_wd[CONFIG_PATHS] = {-1, -1, -1, -1};
+
+/* main loop: handlers indexed by fd, epoll on linux and poll() elsewhere */
+LoopFd *loop_fds = NULL;
+int loop_fds_cap = 0;
+int loop_fd = -1;
+int signal_fd = -1;
+int signal_pipe[2] = {-1, -1};
+int timer_fd = -1;
+long timers[TIMER_COUNT];
+void (*const timer_fns[TIMER_COUNT])(void) = {
+	[TIMER_RELOAD] = reload_config,
+};
+
+extern char **environ;
+
+/* metrics registry, see metrics_dump() */
+unsigned long metrics[METRIC_COUNT];
+const char *metric_names[METRIC_COUNT] = {
+	[METRIC_TILE] = "tile",
+	[METRIC_CONFIGURE] = "configure",
+	[METRIC_BORDER] = "border",
+	[METRIC_ROUNDTRIP] = "roundtrip",
+	[METRIC_ATOMS] = "atom_requests",
+	[METRIC_SPAWN] = "spawn",
+	[METRIC_SPAWN_FAILED] = "spawn_failed",
+	[METRIC_CHILD_EXIT] = "child_exit",
+	[METRIC_CHILD_FAILED] = "child_failed",
+};
+Histogram event_hist[LASTEvent + 1]; /* the extra slot is RandR */
+Histogram spawn_hist;
+unsigned long xerrors[256]; /* by request code */
+
+/* control socket, see setup_ipc() */
+int ipc_fd = -1;
+struct sockaddr_un ipc_addr;
+IpcConn *ipc_conns = NULL;
+int ipc_conns_cap = 0;
+unsigned int ipc_sub_mask = 0; /* union of what the subscribers want */
+Bool ipc_pending = False;
+Bool ipc_batch = False; /* inside ipc_run(), layout and workspace switches wait for flush_dirty() */
+int batch_from_ws = -1; /* workspace on screen before the batch switched away, -1 if it did not */
+/* last state reported to subscribers, see ipc_state_events() */
+int seen_ws = -1;
+int seen_mon = -1;
+Window seen_focus = None;
+int seen_layout[NUM_WORKSPACES];
+
+/* keycode x mod_index() -> index into user_config.binds, -1 when unbound */
+short key_dispatch[256][KEY_MODS];
 
 Bool next_should_float = False;
 
-Client *add_client(Window w, int ws)
+unsigned int dirty = 0;
+Client *warp_target = NULL;
+
+/* what update_borders() last painted, so it only touches what changed */
+Client *border_focus = NULL;
+Bool borders_stale = True;
+Window active_window = None;
+
+Client *add_client(WinInfo *wi, int ws)
 {
-	Client *c = malloc(sizeof(Client));
+	Window w = wi->win;
+	Client *c = client_alloc();
 	if (!c) {
 		fprintf(stderr, "sxwm: could not alloc memory for client\n");
 		return NULL;
@@ -159,6 +395,7 @@ Client *add_client(Window w, int ws)
 	c->win = w;
 	c->next = NULL;
 	c->ws = ws;
+	client_index_add(c);
 
 	if (!workspaces[ws]) {
 		workspaces[ws] = c;
@@ -177,31 +414,20 @@ Client *add_client(Window w, int ws)
 	                 ButtonPressMask | ButtonReleaseMask | PointerMotionMask);
 
 	XGrabButton(dpy, Button1, 0, w, False, ButtonPressMask, GrabModeSync, GrabModeAsync, None, None);
-	XGrabButton(dpy, Button1, user_config.modkey, w, False, ButtonPressMask, GrabModeSync, GrabModeAsync, None, None);
-	XGrabButton(dpy, Button1, user_config.modkey | ShiftMask, w, False, ButtonPressMask, GrabModeSync, GrabModeAsync,
-	            None, None);
-	XGrabButton(dpy, Button3, user_config.modkey, w, False, ButtonPressMask, GrabModeSync, GrabModeAsync, None, None);
+	grab_buttons(w, user_config.modkey);
 
-	Atom protos[] = {atom_wm_delete};
-	XSetWMProtocols(dpy, w, protos, 1);
-
-	XWindowAttributes wa;
-	XGetWindowAttributes(dpy, w, &wa);
-	c->x = wa.x;
-	c->y = wa.y;
-	c->w = wa.width;
-	c->h = wa.height;
+	c->x = wi->x;
+	c->y = wi->y;
+	c->w = wi->w;
+	c->h = wi->h;
 
 	/* set monitor based on pointer location */
-	Window root_ret, child_ret;
-	int root_x, root_y, win_x, win_y;
-	unsigned int mask;
 	int pointer_mon = 0;
 
-	if (XQueryPointer(dpy, root, &root_ret, &child_ret, &root_x, &root_y, &win_x, &win_y, &mask)) {
+	if (wi->has_pointer) {
 		for (int i = 0; i < monsn; i++) {
-			if (root_x >= mons[i].x && root_x < mons[i].x + mons[i].w && root_y >= mons[i].y &&
-			    root_y < mons[i].y + mons[i].h) {
+			if (wi->ptr_x >= mons[i].x && wi->ptr_x < mons[i].x + mons[i].w && wi->ptr_y >= mons[i].y &&
+			    wi->ptr_y < mons[i].y + mons[i].h) {
 				pointer_mon = i;
 				break;
 			}
@@ -213,7 +439,13 @@ Client *add_client(Window w, int ws)
 	c->floating = False;
 	c->fullscreen = False;
 	c->mapped = True;
+	c->map_pending = False;
 	c->custom_stack_height = 0;
+	c->border_col = -1;
+	c->protocols = wi->protocols;
+	c->transient_for = wi->transient_for;
+	c->hints = wi->hints;
+	borders_stale = True;
 
 	if (global_floating) {
 		c->floating = True;
@@ -223,68 +455,209 @@ Client *add_client(Window w, int ws)
 		focused = c;
 	}
 
-	long desktop = ws;
-	XChangeProperty(dpy, w, XInternAtom(dpy, "_NET_WM_DESKTOP", False), XA_CARDINAL, 32, PropModeReplace,
-	                (unsigned char *)&desktop, 1);
-
-	XRaiseWindow(dpy, w);
+	update_client_desktop(c);
+	client_list_add(c);
+	raise_client(c);
+	ipc_client_event("map", c);
 	return c;
 }
 
+void buf_append(Buf *b, const char *data, int len)
+{
+	if (!grow_array((void **)&b->data, &b->cap, b->len + len, 1)) {
+		return;
+	}
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+}
+
+void buf_printf(Buf *b, const char *fmt, ...)
+{
+	char line[512];
+	va_list ap;
+	va_start(ap, fmt);
+	int n = vsnprintf(line, sizeof line, fmt, ap);
+	va_end(ap);
+	if (n > 0) {
+		buf_append(b, line, MIN(n, (int)sizeof line - 1));
+	}
+}
+
 void change_workspace(int ws)
 {
 	if (ws >= NUM_WORKSPACES || ws == current_ws) {
 		return;
 	}
 
-	in_ws_switch = True;
-	XGrabServer(dpy);
+	int old_ws = current_ws;
+	current_ws = ws;
+	focused = workspaces[current_ws];
+	borders_stale = True;
+	mark_dirty(DIRTY_BORDERS);
 
-	/* unmap those still marked mapped */
-	for (Client *c = workspaces[current_ws]; c; c = c->next) {
-		if (c->mapped) {
-			XUnmapWindow(dpy, c->win);
+	/* a chain of switches only swaps the first workspace for the last one, after the layout */
+	if (ipc_batch) {
+		if (batch_from_ws < 0) {
+			batch_from_ws = old_ws;
 		}
+		mark_dirty(DIRTY_LAYOUT | DIRTY_WORKSPACE);
+		return;
 	}
 
-	current_ws = ws;
+	/* give the incoming windows their final geometry before they show up */
+	tile();
+	show_workspace(old_ws);
+}
 
-	/* map those still marked mapped */
-	for (Client *c = workspaces[current_ws]; c; c = c->next) {
-		if (c->mapped) {
-			XMapWindow(dpy, c->win);
+int clean_mask(int mask)
+{
+	return mask & ~(LockMask | Mod2Mask | Mod3Mask);
+}
+
+Client *client_alloc(void)
+{
+	if (!client_free) {
+		/* each slab doubles the previous one so large sessions take few allocations */
+		int n = client_slab_total ? client_slab_total : CLIENT_SLAB_MIN;
+		ClientSlab *slab = malloc(sizeof(ClientSlab) + n * sizeof(Client));
+		if (!slab) {
+			return NULL;
+		}
+		slab->n = n;
+		slab->next = client_slabs;
+		client_slabs = slab;
+		client_slab_total += n;
+
+		/* thread the new records onto the free list in address order */
+		for (int i = n - 1; i >= 0; i--) {
+			slab->clients[i].next = client_free;
+			client_free = &slab->clients[i];
 		}
 	}
 
-	tile();
+	Client *c = client_free;
+	client_free = c->next;
+	memset(c, 0, sizeof(Client));
+	return c;
+}
 
-	focused = NULL;
-	if (workspaces[current_ws]) {
-		focused = workspaces[current_ws];
-		Window focused_win = find_toplevel(focused->win);
-		XSetInputFocus(dpy, focused_win, RevertToPointerRoot, CurrentTime);
-		if (user_config.warp_cursor) {
-			warp_cursor(focused);
+void client_index_add(Client *c)
+{
+	/* keep the load factor at or below one */
+	if (client_index_count + 1 > client_index_size) {
+		unsigned int size = client_index_size ? client_index_size * 2 : 64;
+		Client **tab = calloc(size, sizeof(Client *));
+		if (!tab) {
+			fprintf(stderr, "sxwm: could not grow client index\n");
+			return;
 		}
-		update_borders();
+		for (unsigned int i = 0; i < client_index_size; i++) {
+			Client *n;
+			for (Client *p = client_index[i]; p; p = n) {
+				n = p->hash_next;
+				unsigned int h = client_hash(p->win) & (size - 1);
+				p->hash_next = tab[h];
+				tab[h] = p;
+			}
+		}
+		free(client_index);
+		client_index = tab;
+		client_index_size = size;
 	}
-	else {
-		XSetInputFocus(dpy, root, RevertToPointerRoot, CurrentTime);
+
+	unsigned int h = client_hash(c->win) & (client_index_size - 1);
+	c->hash_next = client_index[h];
+	client_index[h] = c;
+	client_index_count++;
+}
+
+void client_index_remove(Client *c)
+{
+	if (!client_index_size) {
+		return;
 	}
+	unsigned int h = client_hash(c->win) & (client_index_size - 1);
+	for (Client **pp = &client_index[h]; *pp; pp = &(*pp)->hash_next) {
+		if (*pp == c) {
+			*pp = c->hash_next;
+			c->hash_next = NULL;
+			client_index_count--;
+			return;
+		}
+	}
+}
 
-	long cd = current_ws;
-	XChangeProperty(dpy, root, XInternAtom(dpy, "_NET_CURRENT_DESKTOP", False), XA_CARDINAL, 32, PropModeReplace,
-	                (unsigned char *)&cd, 1);
-	update_client_desktop_properties();
+void client_list_add(Client *c)
+{
+	if (!grow_array((void **)&client_list, &client_list_cap, client_list_n + 1, sizeof(Window)) ||
+	    !grow_array((void **)&stack_list, &stack_list_cap, stack_list_n + 1, sizeof(Window))) {
+		return;
+	}
 
-	XUngrabServer(dpy);
-	XSync(dpy, False);
-	in_ws_switch = False;
+	/* new clients go to the end of the mapping order and on top of the stack */
+	client_list[client_list_n++] = c->win;
+	stack_list[stack_list_n++] = c->win;
+	/* scan_existing_windows() publishes the whole lists once at the end */
+	if (adopting) {
+		return;
+	}
+	XChangeProperty(dpy, root, atoms[NET_CLIENT_LIST], XA_WINDOW, 32, PropModeAppend, (unsigned char *)&c->win, 1);
+	XChangeProperty(dpy, root, atoms[NET_CLIENT_LIST_STACKING], XA_WINDOW, 32, PropModeAppend,
+	                (unsigned char *)&c->win, 1);
 }
 
-int clean_mask(int mask)
+void client_list_remove(Window w)
 {
-	return mask & ~(LockMask | Mod2Mask | Mod3Mask);
+	for (int i = 0; i < client_list_n; i++) {
+		if (client_list[i] == w) {
+			memmove(&client_list[i], &client_list[i + 1], (client_list_n - i - 1) * sizeof(Window));
+			client_list_n--;
+			mark_dirty(DIRTY_CLIENTS);
+			break;
+		}
+	}
+	for (int i = 0; i < stack_list_n; i++) {
+		if (stack_list[i] == w) {
+			memmove(&stack_list[i], &stack_list[i + 1], (stack_list_n - i - 1) * sizeof(Window));
+			stack_list_n--;
+			mark_dirty(DIRTY_STACKING);
+			break;
+		}
+	}
+}
+
+void client_refresh_property(Client *c, Atom atom)
+{
+	/* the only round-trip for these, and only when the client changes them */
+	xcb_get_property_reply_t *r;
+	if (atom == atoms[WM_PROTOCOLS]) {
+		r = xcb_get_property_reply(
+		    xconn, xcb_get_property(xconn, 0, c->win, atoms[WM_PROTOCOLS], XCB_ATOM_ATOM, 0, 16), NULL);
+		c->protocols = protocols_from_reply(r);
+	}
+	else if (atom == XA_WM_NORMAL_HINTS) {
+		r = xcb_get_property_reply(
+		    xconn, xcb_get_property(xconn, 0, c->win, XCB_ATOM_WM_NORMAL_HINTS, XCB_ATOM_WM_SIZE_HINTS, 0, 18),
+		    NULL);
+		size_hints_from_reply(r, &c->hints);
+	}
+	else if (atom == XA_WM_TRANSIENT_FOR) {
+		r = xcb_get_property_reply(
+		    xconn, xcb_get_property(xconn, 0, c->win, XCB_ATOM_WM_TRANSIENT_FOR, XCB_ATOM_WINDOW, 0, 1), NULL);
+		c->transient_for = transient_from_reply(r);
+	}
+	else {
+		return;
+	}
+	COUNT(METRIC_ROUNDTRIP);
+	free(r);
+}
+
+void client_release(Client *c)
+{
+	c->win = None;
+	c->next = client_free;
+	client_free = c;
 }
 
 void close_focused(void)
@@ -293,35 +666,208 @@ void close_focused(void)
 		return;
 	}
 
-	Atom *protos;
-	int n;
-	if (XGetWMProtocols(dpy, focused->win, &protos, &n) && protos) {
-		for (int i = 0; i < n; i++) {
-			if (protos[i] == atom_wm_delete) {
-				XEvent ev = {.xclient = {.type = ClientMessage,
-				                         .window = focused->win,
-				                         .message_type = XInternAtom(dpy, "WM_PROTOCOLS", False),
-				                         .format = 32}};
-				ev.xclient.data.l[0] = atom_wm_delete;
-				ev.xclient.data.l[1] = CurrentTime;
-				XSendEvent(dpy, focused->win, False, NoEventMask, &ev);
-				XFree(protos);
-				return;
-			}
-		}
-		XUnmapWindow(dpy, focused->win);
-		XFree(protos);
+	if (focused->protocols & PROTO_DELETE) {
+		XEvent ev = {.xclient = {.type = ClientMessage,
+		                         .window = focused->win,
+		                         .message_type = atoms[WM_PROTOCOLS],
+		                         .format = 32}};
+		ev.xclient.data.l[0] = atoms[WM_DELETE_WINDOW];
+		ev.xclient.data.l[1] = CurrentTime;
+		XSendEvent(dpy, focused->win, False, NoEventMask, &ev);
+		return;
 	}
 	XUnmapWindow(dpy, focused->win);
 	XKillClient(dpy, focused->win);
 }
 
+/* sees every request Xlib writes, its own and libXcursor's included, and counts the InternAtoms */
+void count_requests(Display *d, XExtCodes *codes, const char *data, long len)
+{
+	/* bytes of a request whose header came in an earlier chunk */
+	static unsigned long skip = 0;
+	(void)d;
+	(void)codes;
+
+	while (len > 0) {
+		if (skip) {
+			unsigned long n = MIN(skip, (unsigned long)len);
+			data += n;
+			len -= n;
+			skip -= n;
+			continue;
+		}
+		/* Xlib always writes a request header whole */
+		if (len < 4) {
+			break;
+		}
+		CARD16 words16;
+		memcpy(&words16, data + 2, sizeof words16);
+		unsigned long words = words16;
+		if (!words && len >= 8) {
+			/* BIG-REQUESTS: the real length follows */
+			CARD32 words32;
+			memcpy(&words32, data + 4, sizeof words32);
+			words = words32;
+		}
+		if ((unsigned char)data[0] == X_InternAtom) {
+			COUNT(METRIC_ATOMS);
+		}
+		skip = words * 4;
+	}
+}
+
 void dec_gaps(void)
 {
 	if (user_config.gaps > 0) {
 		user_config.gaps--;
-		tile();
-		update_borders();
+		mark_dirty(DIRTY_LAYOUT | DIRTY_BORDERS);
+	}
+}
+
+void dec_nmaster(void)
+{
+	if (ws_nmaster[current_ws] > 0) {
+		ws_nmaster[current_ws]--;
+		mark_dirty(DIRTY_LAYOUT | DIRTY_BORDERS);
+	}
+}
+
+void dock_add(WinInfo *wi)
+{
+	Dock *d = dock_find(wi->win);
+	if (!d) {
+		d = malloc(sizeof(Dock));
+		if (!d) {
+			fprintf(stderr, "sxwm: could not alloc memory for dock\n");
+			return;
+		}
+		d->win = wi->win;
+		d->next = docks;
+		docks = d;
+		/* strut changes and removal are pushed to us from now on */
+		XSelectInput(dpy, d->win, PropertyChangeMask | StructureNotifyMask);
+	}
+	memcpy(d->strut, wi->strut, sizeof d->strut);
+	mark_dirty(DIRTY_STRUTS);
+}
+
+Dock *dock_find(Window w)
+{
+	for (Dock *d = docks; d; d = d->next) {
+		if (d->win == w) {
+			return d;
+		}
+	}
+	return NULL;
+}
+
+Bool dock_remove(Window w)
+{
+	for (Dock **dp = &docks; *dp; dp = &(*dp)->next) {
+		if ((*dp)->win == w) {
+			Dock *d = *dp;
+			*dp = d->next;
+			free(d);
+			mark_dirty(DIRTY_STRUTS);
+			return True;
+		}
+	}
+	return False;
+}
+
+void dock_update_strut(Dock *d)
+{
+	xcb_get_property_cookie_t pc =
+	    xcb_get_property(xconn, 0, d->win, atoms[NET_WM_STRUT_PARTIAL], XCB_ATOM_CARDINAL, 0, 12);
+	xcb_get_property_cookie_t lc = xcb_get_property(xconn, 0, d->win, atoms[NET_WM_STRUT], XCB_ATOM_CARDINAL, 0, 4);
+	COUNT(METRIC_ROUNDTRIP);
+	xcb_get_property_reply_t *partial = xcb_get_property_reply(xconn, pc, NULL);
+	xcb_get_property_reply_t *legacy = xcb_get_property_reply(xconn, lc, NULL);
+
+	strut_from_replies(partial, legacy, d->strut);
+	free(partial);
+	free(legacy);
+	mark_dirty(DIRTY_STRUTS);
+}
+
+/* the drag cursors are read from the theme on the first drag, not at startup */
+Cursor drag_cursor(Bool move)
+{
+	if (move && !c_move) {
+		c_move = XcursorLibraryLoadCursor(dpy, "fleur");
+	}
+	if (!move && !c_resize) {
+		c_resize = XcursorLibraryLoadCursor(dpy, "bottom_right_corner");
+	}
+	return move ? c_move : c_resize;
+}
+
+void drag_to(int x_root, int y_root, Window child)
+{
+	if (drag_mode == DRAG_SWAP) {
+		Client *new_target = find_client(child);
+		if (new_target && (new_target == drag_client || new_target->floating || new_target->ws != current_ws)) {
+			new_target = NULL;
+		}
+
+		if (new_target != swap_target) {
+			if (swap_target) {
+				set_border(swap_target,
+				           swap_target == focused ? user_config.border_foc_col : user_config.border_ufoc_col);
+			}
+			if (new_target) {
+				set_border(new_target, user_config.border_swap_col);
+			}
+		}
+
+		swap_target = new_target;
+		return;
+	}
+
+	else if (drag_mode == DRAG_MOVE) {
+		int dx = x_root - drag_start_x;
+		int dy = y_root - drag_start_y;
+		int nx = drag_orig_x + dx;
+		int ny = drag_orig_y + dy;
+
+		int outer_w = drag_client->w + 2 * user_config.border_width;
+		int outer_h = drag_client->h + 2 * user_config.border_width;
+
+		if (UDIST(nx, 0) <= user_config.snap_distance) {
+			nx = 0;
+		}
+		else if (UDIST(nx + outer_w, scr_width) <= user_config.snap_distance) {
+			nx = scr_width - outer_w;
+		}
+
+		if (UDIST(ny, 0) <= user_config.snap_distance) {
+			ny = 0;
+		}
+		else if (UDIST(ny + outer_h, scr_height) <= user_config.snap_distance) {
+			ny = scr_height - outer_h;
+		}
+
+		if (!drag_client->floating && (UDIST(nx, drag_client->x) > user_config.snap_distance ||
+		                               UDIST(ny, drag_client->y) > user_config.snap_distance)) {
+			toggle_floating();
+		}
+
+		XMoveWindow(dpy, drag_client->win, nx, ny);
+		COUNT(METRIC_CONFIGURE);
+		drag_client->x = nx;
+		drag_client->y = ny;
+	}
+
+	else if (drag_mode == DRAG_RESIZE) {
+		int dx = x_root - drag_start_x;
+		int dy = y_root - drag_start_y;
+		int nw = drag_orig_w + dx;
+		int nh = drag_orig_h + dy;
+		size_hints_apply(&drag_client->hints, &nw, &nh);
+		drag_client->w = nw < 20 ? 20 : nw;
+		drag_client->h = nh < 20 ? 20 : nh;
+		XResizeWindow(dpy, drag_client->win, drag_client->w, drag_client->h);
+		COUNT(METRIC_CONFIGURE);
 	}
 }
 
@@ -341,6 +887,38 @@ void startup_exec(void)
 	}
 }
 
+Client *find_client(Window w)
+{
+	if (!client_index_size) {
+		return NULL;
+	}
+	for (Client *c = client_index[client_hash(w) & (client_index_size - 1)]; c; c = c->hash_next) {
+		if (c->win == w) {
+			return c;
+		}
+	}
+	return NULL;
+}
+
+Bool grow_array(void **arr, int *cap, int need, size_t size)
+{
+	if (need <= *cap) {
+		return True;
+	}
+	int n = *cap ? *cap : CLIENT_SLAB_MIN;
+	while (n < need) {
+		n *= 2;
+	}
+	void *p = realloc(*arr, n * size);
+	if (!p) {
+		fprintf(stderr, "sxwm: could not grow buffer to %d entries\n", need);
+		return False;
+	}
+	*arr = p;
+	*cap = n;
+	return True;
+}
+
 Window find_toplevel(Window w)
 {
 	Window root = None;
@@ -352,6 +930,7 @@ Window find_toplevel(Window w)
 		if (w == root) {
 			break;
 		}
+		COUNT(METRIC_ROUNDTRIP);
 		if (XQueryTree(dpy, w, &root, &parent, &kids, &nkids) == 0) {
 			break;
 		}
@@ -364,6 +943,56 @@ Window find_toplevel(Window w)
 	return w;
 }
 
+void flush_dirty(void)
+{
+	if (dirty & DIRTY_MONITORS) {
+		update_monitors();
+	}
+	if (dirty & DIRTY_STRUTS) {
+		update_struts();
+	}
+	if (dirty & DIRTY_LAYOUT) {
+		tile();
+	}
+	if (dirty & DIRTY_WORKSPACE) {
+		show_workspace(batch_from_ws);
+		batch_from_ws = -1;
+	}
+	if (dirty & DIRTY_MAP) {
+		for (Client *c = workspaces[current_ws]; c; c = c->next) {
+			if (c->map_pending) {
+				XMapWindow(dpy, c->win);
+				c->map_pending = False;
+			}
+		}
+	}
+	if ((dirty & DIRTY_FOCUS) && focused && focused->ws == current_ws) {
+		XSetInputFocus(dpy, focused->win, RevertToPointerRoot, CurrentTime);
+		send_wm_take_focus(focused);
+	}
+	if (dirty & DIRTY_BORDERS) {
+		update_borders();
+	}
+	if (dirty & DIRTY_CLIENTS) {
+		update_net_client_list();
+	}
+	if (dirty & DIRTY_STACKING) {
+		update_net_client_stacking();
+	}
+	if ((dirty & DIRTY_WARP) && warp_target && warp_target->ws == current_ws) {
+		int center_x = warp_target->x + (warp_target->w / 2);
+		int center_y = warp_target->y + (warp_target->h / 2);
+		XWarpPointer(dpy, None, root, 0, 0, 0, 0, center_x, center_y);
+	}
+
+	dirty = 0;
+	warp_target = NULL;
+	XFlush(dpy);
+
+	ipc_state_events();
+	ipc_flush();
+}
+
 void focus_next(void)
 {
 	if (!workspaces[current_ws]) {
@@ -386,10 +1015,10 @@ void focus_next(void)
 	focused = c;
 	current_monitor = c->mon;
 	XSetInputFocus(dpy, c->win, RevertToPointerRoot, CurrentTime);
-	XRaiseWindow(dpy, c->win);
+	raise_client(c);
 	if (user_config.warp_cursor)
 		warp_cursor(c);
-	update_borders();
+	mark_dirty(DIRTY_BORDERS);
 }
 
 void focus_prev(void)
@@ -430,11 +1059,11 @@ void focus_prev(void)
 	current_monitor = c->mon;
 
 	XSetInputFocus(dpy, c->win, RevertToPointerRoot, CurrentTime);
-	XRaiseWindow(dpy, c->win);
+	raise_client(c);
 	if (user_config.warp_cursor) {
 		warp_cursor(c);
 	}
-	update_borders();
+	mark_dirty(DIRTY_BORDERS);
 }
 
 void focus_next_mon(void)
@@ -461,11 +1090,11 @@ void focus_next_mon(void)
 		focused = target_client;
 		current_monitor = target_mon;
 		XSetInputFocus(dpy, focused->win, RevertToPointerRoot, CurrentTime);
-		XRaiseWindow(dpy, focused->win);
+		raise_client(focused);
 		if (user_config.warp_cursor) {
 			warp_cursor(focused);
 		}
-		update_borders();
+		mark_dirty(DIRTY_BORDERS);
 	}
 	else {
 		/* no windows on target monitor, just move cursor to center and update current_monitor */
@@ -473,7 +1102,6 @@ void focus_next_mon(void)
 		int center_x = mons[target_mon].x + mons[target_mon].w / 2;
 		int center_y = mons[target_mon].y + mons[target_mon].h / 2;
 		XWarpPointer(dpy, None, root, 0, 0, 0, 0, center_x, center_y);
-		XSync(dpy, False);
 	}
 }
 
@@ -501,11 +1129,11 @@ void focus_prev_mon(void)
 		focused = target_client;
 		current_monitor = target_mon;
 		XSetInputFocus(dpy, focused->win, RevertToPointerRoot, CurrentTime);
-		XRaiseWindow(dpy, focused->win);
+		raise_client(focused);
 		if (user_config.warp_cursor) {
 			warp_cursor(focused);
 		}
-		update_borders();
+		mark_dirty(DIRTY_BORDERS);
 	}
 	else {
 		/* no windows on target monitor, just move cursor to center and update current_monitor */
@@ -513,7 +1141,6 @@ void focus_prev_mon(void)
 		int center_x = mons[target_mon].x + mons[target_mon].w / 2;
 		int center_y = mons[target_mon].y + mons[target_mon].h / 2;
 		XWarpPointer(dpy, None, root, 0, 0, 0, 0, center_x, center_y);
-		XSync(dpy, False);
 	}
 }
 
@@ -549,17 +1176,20 @@ void move_next_mon(void)
 		focused->x = x;
 		focused->y = y;
 		XMoveWindow(dpy, focused->win, x, y);
+		COUNT(METRIC_CONFIGURE);
 	}
 
+	ipc_client_event("move", focused);
+
 	/* retile to update layouts on both monitors */
-	tile();
+	mark_dirty(DIRTY_LAYOUT);
 
 	/* follow the window with cursor if enabled */
 	if (user_config.warp_cursor) {
 		warp_cursor(focused);
 	}
 
-	update_borders();
+	mark_dirty(DIRTY_BORDERS);
 }
 
 void move_prev_mon(void)
@@ -594,17 +1224,20 @@ void move_prev_mon(void)
 		focused->x = x;
 		focused->y = y;
 		XMoveWindow(dpy, focused->win, x, y);
+		COUNT(METRIC_CONFIGURE);
 	}
 
+	ipc_client_event("move", focused);
+
 	/* retile to update layouts on both monitors */
-	tile();
+	mark_dirty(DIRTY_LAYOUT);
 
 	/* follow the window with cursor if enabled */
 	if (user_config.warp_cursor) {
 		warp_cursor(focused);
 	}
 
-	update_borders();
+	mark_dirty(DIRTY_BORDERS);
 }
 
 int get_monitor_for(Client *c)
@@ -618,17 +1251,19 @@ int get_monitor_for(Client *c)
 	return 0;
 }
 
-void grab_keys(void)
+/* keycode x mod_index() of every binding, matching how hdl_keypress() looks presses up */
+void build_key_dispatch(short (*table)[KEY_MODS])
 {
-	const int guards[] = {0,
-	                      LockMask,
-	                      Mod2Mask,
-	                      LockMask | Mod2Mask,
-	                      Mod5Mask,
-	                      LockMask | Mod5Mask,
-	                      Mod2Mask | Mod5Mask,
-	                      LockMask | Mod2Mask | Mod5Mask};
-	XUngrabKey(dpy, AnyKey, AnyModifier, root);
+	memset(table, -1, sizeof(short) * 256 * KEY_MODS);
+
+	/* one fetch of the whole keymap, every keycode that produces a bound keysym is used */
+	int min_kc, max_kc, per_kc;
+	XDisplayKeycodes(dpy, &min_kc, &max_kc);
+	COUNT(METRIC_ROUNDTRIP);
+	KeySym *map = XGetKeyboardMapping(dpy, min_kc, max_kc - min_kc + 1, &per_kc);
+	if (!map) {
+		return;
+	}
 
 	for (int i = 0; i < user_config.bindsn; i++) {
 		Binding *b = &user_config.binds[i];
@@ -638,79 +1273,144 @@ void grab_keys(void)
 			continue;
 		}
 
-		KeyCode kc = XKeysymToKeycode(dpy, b->keysym);
-		if (!kc) {
-			continue;
-		}
-
-		for (size_t g = 0; g < sizeof guards / sizeof *guards; g++) {
-			XGrabKey(dpy, kc, b->mods | guards[g], root, True, GrabModeAsync, GrabModeAsync);
+		int m = mod_index(b->mods);
+		for (int kc = min_kc; kc <= max_kc; kc++) {
+			/* presses are matched on the unshifted keysym of the first group */
+			if (map[(kc - min_kc) * per_kc] == b->keysym && table[kc][m] < 0) {
+				table[kc][m] = i;
+			}
 		}
 	}
+	XFree(map);
 }
 
-void hdl_button(XEvent *xev)
+void grab_buttons(Window w, int mod)
 {
-	XButtonEvent *e = &xev->xbutton;
-	Window w = (e->subwindow != None) ? e->subwindow : e->window;
-	w = find_toplevel(w);
-
-	XAllowEvents(dpy, ReplayPointer, e->time);
-	if (!w) {
+	if (w == root) {
+		XGrabButton(dpy, Button1, mod, root, True, ButtonPressMask | ButtonReleaseMask | PointerMotionMask,
+		            GrabModeAsync, GrabModeAsync, None, None);
+		XGrabButton(dpy, Button1, mod | ShiftMask, root, True, ButtonPressMask | ButtonReleaseMask | PointerMotionMask,
+		            GrabModeAsync, GrabModeAsync, None, None);
+		XGrabButton(dpy, Button3, mod, root, True, ButtonPressMask | ButtonReleaseMask | PointerMotionMask,
+		            GrabModeAsync, GrabModeAsync, None, None);
 		return;
 	}
+	XGrabButton(dpy, Button1, mod, w, False, ButtonPressMask, GrabModeSync, GrabModeAsync, None, None);
+	XGrabButton(dpy, Button1, mod | ShiftMask, w, False, ButtonPressMask, GrabModeSync, GrabModeAsync, None, None);
+	XGrabButton(dpy, Button3, mod, w, False, ButtonPressMask, GrabModeSync, GrabModeAsync, None, None);
+}
 
-	Client *head = workspaces[current_ws];
-	for (Client *c = head; c; c = c->next) {
-		if (c->win != w) {
-			continue;
-		}
-
-		/* begin swap drag mode */
-		if ((e->state & user_config.modkey) && (e->state & ShiftMask) && e->button == Button1 && !c->floating) {
-			drag_client = c;
-			drag_start_x = e->x_root;
-			drag_start_y = e->y_root;
-			drag_orig_x = c->x;
-			drag_orig_y = c->y;
-			drag_orig_w = c->w;
-			drag_orig_h = c->h;
-			drag_mode = DRAG_SWAP;
-			XGrabPointer(dpy, root, True, ButtonReleaseMask | PointerMotionMask, GrabModeAsync, GrabModeAsync, None,
-			             c_move, CurrentTime);
-			focused = c;
-			XSetInputFocus(dpy, c->win, RevertToPointerRoot, CurrentTime);
-			XSetWindowBorder(dpy, c->win, user_config.border_swap_col);
-			XRaiseWindow(dpy, c->win);
-			return;
-		}
-
-		if ((e->state & user_config.modkey) && (e->button == Button1 || e->button == Button3) && !c->floating) {
-			focused = c;
-			toggle_floating();
-		}
-
-		if (!(e->state & user_config.modkey) && e->button == Button1) {
-			focused = c;
-			XSetInputFocus(dpy, c->win, RevertToPointerRoot, CurrentTime);
-			send_wm_take_focus(c->win);
-			XRaiseWindow(dpy, c->win);
-			update_borders();
-			return;
+void grab_key(int kc, int m, Bool grab)
+{
+	const int guards[] = {0,
+	                      LockMask,
+	                      Mod2Mask,
+	                      LockMask | Mod2Mask,
+	                      Mod5Mask,
+	                      LockMask | Mod5Mask,
+	                      Mod2Mask | Mod5Mask,
+	                      LockMask | Mod2Mask | Mod5Mask};
+	int mods = mod_mask(m);
+
+	for (size_t g = 0; g < sizeof guards / sizeof *guards; g++) {
+		if (grab) {
+			XGrabKey(dpy, kc, mods | guards[g], root, True, GrabModeAsync, GrabModeAsync);
+		}
+		else {
+			XUngrabKey(dpy, kc, mods | guards[g], root);
 		}
+	}
+}
 
-		if (!c->floating) {
-			return;
+void grab_keys(void)
+{
+	XUngrabKey(dpy, AnyKey, AnyModifier, root);
+	build_key_dispatch(key_dispatch);
+
+	for (int kc = 0; kc < 256; kc++) {
+		for (int m = 0; m < KEY_MODS; m++) {
+			if (key_dispatch[kc][m] >= 0) {
+				grab_key(kc, m, True);
+			}
 		}
+	}
+}
 
-		if (c->fixed && e->button == Button3) {
-			return;
+void hide_client(Client *c)
+{
+	/* never reached the server as mapped, show_client() will map it */
+	if (c->map_pending) {
+		c->map_pending = False;
+		return;
+	}
+	if (user_config.park_hidden) {
+		/* keep it mapped but off-screen, no unmap/map or expose storm */
+		if (!c->parked) {
+			XMoveWindow(dpy, c->win, -2 * (c->w + 2 * user_config.border_width), c->y);
+			COUNT(METRIC_CONFIGURE);
+			c->parked = True;
+		}
+		return;
+	}
+	c->ignore_unmap++;
+	XUnmapWindow(dpy, c->win);
+}
+
+void handle_signal(int signo)
+{
+	switch (signo) {
+		case SIGCHLD: {
+			int status;
+			while (waitpid(-1, &status, WNOHANG) > 0) {
+				COUNT(METRIC_CHILD_EXIT);
+				if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+					COUNT(METRIC_CHILD_FAILED);
+				}
+			}
+			break;
+		}
+		case SIGHUP:
+			reload_config();
+			break;
+		case SIGINT:
+		case SIGTERM:
+			/* leave the clients alone, unlike quit() */
+			running = False;
+			break;
+		case SIGUSR1: {
+			printf("sxwm: %d windows, workspace %d, monitor %d of %d\n", open_windows, current_ws + 1,
+			       current_monitor + 1, monsn);
+			Buf b = {0};
+			metrics_dump(&b);
+			fwrite(b.data, 1, b.len, stdout);
+			free(b.data);
+			fflush(stdout);
+			break;
 		}
+	}
+}
+
+void hdl_button(XEvent *xev)
+{
+	XButtonEvent *e = &xev->xbutton;
+	Window w = (e->subwindow != None) ? e->subwindow : e->window;
 
-		Cursor cur = (e->button == Button1) ? c_move : c_resize;
-		XGrabPointer(dpy, root, True, ButtonReleaseMask | PointerMotionMask, GrabModeAsync, GrabModeAsync, None, cur,
-		             CurrentTime);
+	XAllowEvents(dpy, ReplayPointer, e->time);
+	if (!w) {
+		return;
+	}
+
+	/* managed windows are top-level already, only walk the tree for the rest */
+	Client *c = find_client(w);
+	if (!c) {
+		c = find_client(find_toplevel(w));
+	}
+	if (!c || c->ws != current_ws) {
+		return;
+	}
 
+	/* begin swap drag mode */
+	if ((e->state & user_config.modkey) && (e->state & ShiftMask) && e->button == Button1 && !c->floating) {
 		drag_client = c;
 		drag_start_x = e->x_root;
 		drag_start_y = e->y_root;
@@ -718,28 +1418,72 @@ void hdl_button(XEvent *xev)
 		drag_orig_y = c->y;
 		drag_orig_w = c->w;
 		drag_orig_h = c->h;
-		drag_mode = (e->button == Button1) ? DRAG_MOVE : DRAG_RESIZE;
+		drag_mode = DRAG_SWAP;
+		XGrabPointer(dpy, root, True, ButtonReleaseMask | PointerMotionMask, GrabModeAsync, GrabModeAsync, None,
+		             drag_cursor(True), CurrentTime);
+		focused = c;
+		XSetInputFocus(dpy, c->win, RevertToPointerRoot, CurrentTime);
+		set_border(c, user_config.border_swap_col);
+		raise_client(c);
+		return;
+	}
+
+	if ((e->state & user_config.modkey) && (e->button == Button1 || e->button == Button3) && !c->floating) {
 		focused = c;
+		toggle_floating();
+	}
 
+	if (!(e->state & user_config.modkey) && e->button == Button1) {
+		focused = c;
 		XSetInputFocus(dpy, c->win, RevertToPointerRoot, CurrentTime);
-		update_borders();
-		XRaiseWindow(dpy, c->win);
+		send_wm_take_focus(c);
+		raise_client(c);
+		mark_dirty(DIRTY_BORDERS);
+		return;
+	}
+
+	if (!c->floating) {
 		return;
 	}
+
+	if (c->fixed && e->button == Button3) {
+		return;
+	}
+
+	Cursor cur = drag_cursor(e->button == Button1);
+	XGrabPointer(dpy, root, True, ButtonReleaseMask | PointerMotionMask, GrabModeAsync, GrabModeAsync, None, cur,
+	             CurrentTime);
+
+	drag_client = c;
+	drag_start_x = e->x_root;
+	drag_start_y = e->y_root;
+	drag_orig_x = c->x;
+	drag_orig_y = c->y;
+	drag_orig_w = c->w;
+	drag_orig_h = c->h;
+	drag_mode = (e->button == Button1) ? DRAG_MOVE : DRAG_RESIZE;
+	focused = c;
+
+	XSetInputFocus(dpy, c->win, RevertToPointerRoot, CurrentTime);
+	mark_dirty(DIRTY_BORDERS);
+	raise_client(c);
 }
 
 void hdl_button_release(XEvent *xev)
 {
-	(void)xev;
+	XButtonEvent *e = &xev->xbutton;
+
+	/* a throttled motion may have been skipped, land exactly under the pointer */
+	if (drag_client && (drag_mode == DRAG_MOVE || drag_mode == DRAG_RESIZE)) {
+		drag_to(e->x_root, e->y_root, e->subwindow);
+	}
 
 	if (drag_mode == DRAG_SWAP) {
 		if (swap_target) {
-			XSetWindowBorder(dpy, swap_target->win,
-			                 (swap_target == focused ? user_config.border_foc_col : user_config.border_ufoc_col));
+			set_border(swap_target, swap_target == focused ? user_config.border_foc_col : user_config.border_ufoc_col);
 			swap_clients(drag_client, swap_target);
 		}
-		tile();
-		update_borders();
+		mark_dirty(DIRTY_LAYOUT | DIRTY_BORDERS);
 	}
 
 	XUngrabPointer(dpy, CurrentTime);
@@ -752,15 +1496,15 @@ void hdl_button_release(XEvent *xev)
 void hdl_client_msg(XEvent *xev)
 {
 	/* clickable bar workspace switching */
-	if (xev->xclient.message_type == atom_net_current_desktop) {
+	if (xev->xclient.message_type == atoms[NET_CURRENT_DESKTOP]) {
 		int ws = (int)xev->xclient.data.l[0];
 		change_workspace(ws);
 		return;
 	}
-	if (xev->xclient.message_type == atom_net_wm_state) {
+	if (xev->xclient.message_type == atoms[NET_WM_STATE]) {
 		long action = xev->xclient.data.l[0];
 		Atom target = xev->xclient.data.l[1];
-		if (target == atom_net_wm_state_fullscreen) {
+		if (target == atoms[NET_WM_STATE_FULLSCREEN]) {
 			if (action == 1 || action == 2) {
 				toggle_fullscreen();
 			}
@@ -772,27 +1516,117 @@ void hdl_client_msg(XEvent *xev)
 	}
 }
 
-void hdl_config_ntf(XEvent *xev)
+void hdl_config_watch(int fd)
 {
-	if (xev->xconfigure.window == root) {
-		update_monitors();
-		tile();
-		update_borders();
+#ifdef __linux__
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	while ((len = read(fd, buf, sizeof buf)) > 0) {
+		for (char *p = buf; p < buf + len;) {
+			struct inotify_event *ev = (struct inotify_event *)p;
+			/* editors save in several writes or through a rename, coalesce them into one reload */
+			if (ev->len && !strcmp(ev->name, "sxwmrc")) {
+				timer_set(TIMER_RELOAD, RELOAD_DEBOUNCE_MS);
+			}
+			p += sizeof *ev + ev->len;
+		}
 	}
+#else
+	(void)fd;
+#endif
 }
 
-void hdl_config_req(XEvent *xev)
+void hdl_ipc_accept(int fd)
 {
-	XConfigureRequestEvent *e = &xev->xconfigurerequest;
-	Client *c = NULL;
+	int cfd;
+	while ((cfd = accept(fd, NULL, NULL)) >= 0) {
+		fcntl(cfd, F_SETFL, fcntl(cfd, F_GETFL) | O_NONBLOCK);
+		fcntl(cfd, F_SETFD, FD_CLOEXEC);
+
+		int old_cap = ipc_conns_cap;
+		if (!grow_array((void **)&ipc_conns, &ipc_conns_cap, cfd + 1, sizeof *ipc_conns)) {
+			close(cfd);
+			continue;
+		}
+		memset(ipc_conns + old_cap, 0, (ipc_conns_cap - old_cap) * sizeof *ipc_conns);
+		ipc_conns[cfd].open = True;
+		loop_add(cfd, hdl_ipc_read);
+	}
+}
 
-	for (int ws = 0; ws < NUM_WORKSPACES && !c; ws++) {
-		for (c = workspaces[ws]; c; c = c->next) {
-			if (c->win == e->window) {
-				break;
-			}
+/* a message is everything up to the client closing its write side */
+void hdl_ipc_read(int fd)
+{
+	IpcConn *conn = &ipc_conns[fd];
+	char chunk[4096];
+	ssize_t n;
+	while ((n = read(fd, chunk, sizeof chunk)) > 0) {
+		if (conn->in.len + n > IPC_MSG_MAX) {
+			const char *msg = "error: message too long\n";
+			ipc_reply(fd, msg, strlen(msg));
+			return;
 		}
+		buf_append(&conn->in, chunk, n);
+	}
+
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		return;
+	}
+	if (n < 0) {
+		ipc_close(fd);
+		return;
+	}
+	ipc_run(fd);
+}
+
+/* a connection with output is only watched for hangups, and for writability while it has a backlog */
+void hdl_ipc_sub(int fd)
+{
+	if (!ipc_conns[fd].out.len) {
+		ipc_close(fd);
+		return;
+	}
+	ipc_sub_write(fd);
+}
+
+void hdl_signal(int fd)
+{
+#ifdef __linux__
+	struct signalfd_siginfo si;
+	while (read(fd, &si, sizeof si) == sizeof si) {
+		handle_signal((int)si.ssi_signo);
 	}
+#else
+	unsigned char signo;
+	while (read(fd, &signo, 1) == 1) {
+		handle_signal(signo);
+	}
+#endif
+}
+
+void hdl_timer(int fd)
+{
+#ifdef __linux__
+	uint64_t expirations;
+	while (read(fd, &expirations, sizeof expirations) == sizeof expirations) {
+	}
+#endif
+	(void)fd;
+	timers_run();
+}
+
+void hdl_config_ntf(XEvent *xev)
+{
+	/* with randr the screen change events cover this */
+	if (xev->xconfigure.window == root && !randr_ok) {
+		mark_dirty(DIRTY_MONITORS);
+	}
+}
+
+void hdl_config_req(XEvent *xev)
+{
+	XConfigureRequestEvent *e = &xev->xconfigurerequest;
+	Client *c = find_client(e->window);
 
 	if (!c || c->floating || c->fullscreen) {
 		/* allow client to configure itself */
@@ -804,6 +1638,7 @@ void hdl_config_req(XEvent *xev)
 		                     .sibling = e->above,
 		                     .stack_mode = e->detail};
 		XConfigureWindow(dpy, e->window, e->value_mask, &wc);
+		COUNT(METRIC_CONFIGURE);
 		return;
 	}
 
@@ -820,81 +1655,191 @@ void hdl_dummy(XEvent *xev)
 void hdl_destroy_ntf(XEvent *xev)
 {
 	Window w = xev->xdestroywindow.window;
+	Client *c = find_client(w);
+	if (!c) {
+		dock_remove(w);
+		return;
+	}
 
-	for (int ws = 0; ws < NUM_WORKSPACES; ws++) {
-		Client *prev = NULL, *c = workspaces[ws];
-		while (c && c->win != w) {
-			prev = c;
-			c = c->next;
+	int ws = c->ws;
+	Client *prev = NULL;
+	for (Client *p = workspaces[ws]; p && p != c; p = p->next) {
+		prev = p;
+	}
+
+	if (focused == c) {
+		if (c->next) {
+			focused = c->next;
 		}
-		if (c) {
-			if (focused == c) {
-				if (c->next) {
-					focused = c->next;
-				}
-				else if (prev) {
-					focused = prev;
-				}
-				else {
-					if (ws == current_ws) {
-						focused = NULL;
-					}
-				}
+		else if (prev) {
+			focused = prev;
+		}
+		else {
+			if (ws == current_ws) {
+				focused = NULL;
 			}
+		}
+	}
 
-			if (!prev) {
-				workspaces[ws] = c->next;
-			}
-			else {
-				prev->next = c->next;
-			}
+	if (!prev) {
+		workspaces[ws] = c->next;
+	}
+	else {
+		prev->next = c->next;
+	}
 
-			free(c);
-			update_net_client_list();
-			open_windows--;
+	if (warp_target == c) {
+		warp_target = NULL;
+	}
+	if (border_focus == c) {
+		border_focus = NULL;
+	}
+	if (swap_target == c) {
+		swap_target = NULL;
+	}
+	if (drag_client == c) {
+		XUngrabPointer(dpy, CurrentTime);
+		drag_mode = DRAG_NONE;
+		drag_client = NULL;
+		swap_target = NULL;
+	}
+	ipc_client_event("destroy", c);
+	client_list_remove(c->win);
+	client_index_remove(c);
+	client_release(c);
+	open_windows--;
 
-			if (ws == current_ws) {
-				tile();
-				update_borders();
+	if (ws == current_ws) {
+		mark_dirty(DIRTY_LAYOUT | DIRTY_BORDERS);
 
-				if (focused) {
-					XSetInputFocus(dpy, focused->win, RevertToPointerRoot, CurrentTime);
-					XRaiseWindow(dpy, focused->win);
-				}
-			}
-			return;
+		if (focused) {
+			XSetInputFocus(dpy, focused->win, RevertToPointerRoot, CurrentTime);
+			raise_client(focused);
 		}
 	}
 }
 
 void hdl_keypress(XEvent *xev)
 {
-	KeySym ks = XkbKeycodeToKeysym(dpy, xev->xkey.keycode, 0, 0);
-	int mods = clean_mask(xev->xkey.state);
+	int i = key_dispatch[xev->xkey.keycode][mod_index(xev->xkey.state)];
+	if (i < 0) {
+		return;
+	}
 
-	for (int i = 0; i < user_config.bindsn; i++) {
-		Binding *b = &user_config.binds[i];
-		if (b->keysym == ks && clean_mask(b->mods) == mods) {
-			switch (b->type) {
-				case TYPE_CMD:
-					spawn(b->action.cmd);
-					break;
+	Binding *b = &user_config.binds[i];
+	switch (b->type) {
+		case TYPE_CMD:
+			spawn(b->action.cmd);
+			break;
 
-				case TYPE_FUNC:
-					if (b->action.fn) {
-						b->action.fn();
-					}
-					break;
-				case TYPE_CWKSP:
-					change_workspace(b->action.ws);
-					update_net_client_list();
-					break;
-				case TYPE_MWKSP:
-					move_to_workspace(b->action.ws);
-					update_net_client_list();
-					break;
+		case TYPE_FUNC:
+			if (b->action.fn) {
+				b->action.fn();
 			}
-			return;
+			break;
+		case TYPE_CWKSP:
+			change_workspace(b->action.ws);
+			break;
+		case TYPE_MWKSP:
+			move_to_workspace(b->action.ws);
+			break;
+	}
+}
+
+unsigned int protocols_from_reply(xcb_get_property_reply_t *r)
+{
+	unsigned int flags = 0;
+	if (!r || r->format != 32) {
+		return 0;
+	}
+
+	xcb_atom_t *protos = xcb_get_property_value(r);
+	int n = xcb_get_property_value_length(r) / 4;
+	for (int i = 0; i < n; i++) {
+		if (protos[i] == atoms[WM_DELETE_WINDOW]) {
+			flags |= PROTO_DELETE;
+		}
+		else if (protos[i] == atoms[WM_TAKE_FOCUS]) {
+			flags |= PROTO_TAKE_FOCUS;
+		}
+		else if (protos[i] == atoms[NET_WM_PING]) {
+			flags |= PROTO_PING;
+		}
+		else if (protos[i] == atoms[NET_WM_SYNC_REQUEST]) {
+			flags |= PROTO_SYNC_REQUEST;
+		}
+	}
+	return flags;
+}
+
+void size_hints_apply(const SizeHints *sh, int *w, int *h)
+{
+	/* ICCCM 4.1.2.3: size is base + n * inc, within min and max */
+	if (sh->inc_w > 0) {
+		*w -= (*w - sh->base_w) % sh->inc_w;
+	}
+	if (sh->inc_h > 0) {
+		*h -= (*h - sh->base_h) % sh->inc_h;
+	}
+	if (sh->min_w > 0 && *w < sh->min_w) {
+		*w = sh->min_w;
+	}
+	if (sh->min_h > 0 && *h < sh->min_h) {
+		*h = sh->min_h;
+	}
+	if (sh->max_w > 0 && *w > sh->max_w) {
+		*w = sh->max_w;
+	}
+	if (sh->max_h > 0 && *h > sh->max_h) {
+		*h = sh->max_h;
+	}
+}
+
+/* WM_NORMAL_HINTS: flags, 4 pad, min w/h, max w/h, inc w/h, aspect x4, base w/h, gravity */
+void size_hints_from_reply(xcb_get_property_reply_t *r, SizeHints *sh)
+{
+	memset(sh, 0, sizeof *sh);
+	if (!r || r->format != 32 || xcb_get_property_value_length(r) < 9 * 4) {
+		return;
+	}
+
+	int len = xcb_get_property_value_length(r) / 4;
+	int32_t *v = xcb_get_property_value(r);
+	if (v[0] & PMinSize) {
+		sh->min_w = v[5];
+		sh->min_h = v[6];
+	}
+	if (v[0] & PMaxSize) {
+		sh->max_w = v[7];
+		sh->max_h = v[8];
+	}
+	if ((v[0] & PResizeInc) && len >= 11) {
+		sh->inc_w = v[9];
+		sh->inc_h = v[10];
+	}
+	if ((v[0] & PBaseSize) && len >= 17) {
+		sh->base_w = v[15];
+		sh->base_h = v[16];
+	}
+}
+
+void strut_from_replies(xcb_get_property_reply_t *partial, xcb_get_property_reply_t *legacy, long *strut)
+{
+	memset(strut, 0, 12 * sizeof(long));
+
+	if (partial && partial->format == 32 && xcb_get_property_value_length(partial) >= 12 * 4) {
+		uint32_t *v = xcb_get_property_value(partial);
+		for (int i = 0; i < 12; i++) {
+			strut[i] = v[i];
+		}
+	}
+	else if (legacy && legacy->format == 32 && xcb_get_property_value_length(legacy) >= 4 * 4) {
+		/* legacy struts span the whole edge */
+		uint32_t *v = xcb_get_property_value(legacy);
+		for (int i = 0; i < 4; i++) {
+			strut[i] = v[i];
+			strut[4 + 2 * i] = 0;
+			strut[5 + 2 * i] = (i < 2 ? scr_height : scr_width) - 1;
 		}
 	}
 }
@@ -944,381 +1889,1152 @@ void swap_clients(Client *a, Client *b)
 void hdl_map_req(XEvent *xev)
 {
 	Window w = xev->xmaprequest.window;
-	XWindowAttributes wa;
-
-	if (!XGetWindowAttributes(dpy, w, &wa)) {
-		return;
-	}
-
-	if (wa.override_redirect || wa.width <= 0 || wa.height <= 0) {
-		XMapWindow(dpy, w);
-		return;
-	}
 
 	/* check if this window is already managed on any workspace */
-	for (int ws = 0; ws < NUM_WORKSPACES; ws++) {
-		for (Client *c = workspaces[ws]; c; c = c->next) {
-			if (c->win == w) {
-				if (ws == current_ws) {
-					if (!c->mapped) {
-						XMapWindow(dpy, w);
-						c->mapped = True;
-					}
-					if (user_config.new_win_focus) {
-						focused = c;
-						XSetInputFocus(dpy, c->win, RevertToPointerRoot, CurrentTime);
-						send_wm_take_focus(c->win);
-						if (user_config.warp_cursor) {
-							warp_cursor(c);
-						}
-					}
-					update_borders();
+	Client *managed = find_client(w);
+	if (managed) {
+		if (managed->ws == current_ws) {
+			if (!managed->mapped) {
+				managed->mapped = True;
+				show_client(managed);
+				mark_dirty(DIRTY_LAYOUT);
+				ipc_client_event("map", managed);
+			}
+			if (user_config.new_win_focus) {
+				focused = managed;
+				XSetInputFocus(dpy, managed->win, RevertToPointerRoot, CurrentTime);
+				send_wm_take_focus(managed);
+				if (user_config.warp_cursor) {
+					warp_cursor(managed);
 				}
-				return;
 			}
+			mark_dirty(DIRTY_BORDERS);
 		}
-	}
-
-	Atom type;
-	int format;
-	unsigned long nitems, after;
-	Atom *types = NULL;
-	Bool should_float = False;
-
-	if (XGetWindowProperty(dpy, w, atom_wm_window_type, 0, 8, False, XA_ATOM, &type, &format, &nitems, &after,
-	                       (unsigned char **)&types) == Success &&
-	    types) {
-		Atom dock = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DOCK", False);
-		Atom util = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_UTILITY", False);
-		Atom dialog = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DIALOG", False);
-		Atom toolbar = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_TOOLBAR", False);
-		Atom splash = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_SPLASH", False);
-		Atom popup = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_POPUP_MENU", False);
-
-		for (unsigned long i = 0; i < nitems; i++) {
-			if (types[i] == dock) {
-				XFree(types);
-				XMapWindow(dpy, w);
-				return;
+		else {
+			/* shown on the next switch to its workspace, a parked window can map off-screen now */
+			if (!managed->mapped) {
+				managed->mapped = True;
+				ipc_client_event("map", managed);
 			}
-			if (types[i] == util || types[i] == dialog || types[i] == toolbar || types[i] == splash ||
-			    types[i] == popup) {
-				should_float = True;
-				break;
+			if (managed->parked) {
+				XMapWindow(dpy, w);
 			}
 		}
-		XFree(types);
+		return;
 	}
 
-	if (!should_float) {
-		should_float = window_should_float(w);
-	}
+	/* send every query at once and wait for the replies together */
+	WinFetch wf;
+	WinInfo wi;
+	wininfo_request(w, FETCH_POINTER, &wf);
+	COUNT(METRIC_ROUNDTRIP);
+	wininfo_collect(&wf, &wi);
 
-	if (open_windows == MAXCLIENTS) {
-		fprintf(stderr, "sxwm: max clients reached, ignoring map request\n");
+	if (!wi.valid) {
+		wininfo_free(&wi);
 		return;
 	}
 
-	Client *c = add_client(w, current_ws);
-	if (!c) {
+	manage_window(&wi, False);
+	wininfo_free(&wi);
+}
+
+void hdl_map_ntf(XEvent *xev)
+{
+	XMapEvent *e = &xev->xmap;
+
+	/* override-redirect windows map without a MapRequest, this is where such a bar shows up */
+	if (!e->override_redirect || e->event != root || dock_find(e->window)) {
 		return;
 	}
 
-	Window tr;
-	if (!should_float && XGetTransientForHint(dpy, w, &tr)) {
-		should_float = True;
-	}
-	XSizeHints sh;
-	long sup;
-	if (!should_float && XGetWMNormalHints(dpy, w, &sh, &sup) && (sh.flags & PMinSize) && (sh.flags & PMaxSize) &&
-	    sh.min_width == sh.max_width && sh.min_height == sh.max_height) {
-		should_float = True;
-		c->fixed = True;
+	WinFetch wf;
+	WinInfo wi;
+	wininfo_request(e->window, 0, &wf);
+	COUNT(METRIC_ROUNDTRIP);
+	wininfo_collect(&wf, &wi);
+	if (wi.valid && wi.is_dock) {
+		dock_add(&wi);
 	}
+	wininfo_free(&wi);
+}
 
-	if (should_float || global_floating) {
-		c->floating = True;
+void hdl_mapping_ntf(XEvent *xev)
+{
+	XMappingEvent *e = &xev->xmapping;
+	XRefreshKeyboardMapping(e);
+
+	/* keycodes or modifiers moved, e.g. xmodmap or a layout switch */
+	if (e->request == MappingKeyboard || e->request == MappingModifier) {
+		grab_keys();
 	}
+}
 
-	/* center floating windows & set border */
-	if (c->floating && !c->fullscreen) {
-		int w_ = MAX(c->w, 64), h_ = MAX(c->h, 64);
-		int mx = mons[c->mon].x, my = mons[c->mon].y;
-		int mw = mons[c->mon].w, mh = mons[c->mon].h;
-		int x = mx + (mw - w_) / 2, y = my + (mh - h_) / 2;
-		c->x = x;
-		c->y = y;
-		c->w = w_;
-		c->h = h_;
-		XMoveResizeWindow(dpy, w, x, y, w_, h_);
-		XSetWindowBorderWidth(dpy, w, user_config.border_width);
+void hdl_motion(XEvent *xev)
+{
+	XMotionEvent *e = &xev->xmotion;
+
+	if (drag_mode == DRAG_NONE || !drag_client) {
+		return;
 	}
 
-	/* map & borders */
-	update_net_client_list();
-	if (!global_floating && !c->floating) {
-		tile();
+	/* only the newest position matters, drop the backlog */
+	XEvent next;
+	while (XCheckTypedEvent(dpy, MotionNotify, &next)) {
+		*e = next.xmotion;
 	}
-	else if (c->floating) {
-		XRaiseWindow(dpy, w);
+
+	if (e->time - last_motion_time < motion_interval(e->x_root, e->y_root)) {
+		return;
 	}
+	last_motion_time = e->time;
+	drag_to(e->x_root, e->y_root, e->subwindow);
+}
 
-	XMapWindow(dpy, w);
-	c->mapped = True;
+void hdl_randr(XEvent *xev)
+{
+	if (xev->type == randr_event_base + RRScreenChangeNotify) {
+		XRRUpdateConfiguration(xev);
+	}
+	/* a hotplug comes as a burst of these, rebuild once per batch */
+	mark_dirty(DIRTY_MONITORS);
+}
 
-	if (user_config.new_win_focus) {
-		focused = c;
-		XSetInputFocus(dpy, c->win, RevertToPointerRoot, CurrentTime);
-		send_wm_take_focus(c->win);
-		if (user_config.warp_cursor) {
-			warp_cursor(c);
+void hdl_property(XEvent *xev)
+{
+	XPropertyEvent *e = &xev->xproperty;
+	if (e->window != root) {
+		Client *c = find_client(e->window);
+		if (c) {
+			client_refresh_property(c, e->atom);
+			return;
+		}
+	}
+
+	if (e->atom == atoms[NET_CURRENT_DESKTOP]) {
+		long *val = NULL;
+		Atom actual;
+		int fmt;
+		unsigned long n, after;
+		COUNT(METRIC_ROUNDTRIP);
+		if (XGetWindowProperty(dpy, root, atoms[NET_CURRENT_DESKTOP], 0, 1, False, XA_CARDINAL, &actual, &fmt, &n, &after,
+		                       (unsigned char **)&val) == Success &&
+		    val) {
+			change_workspace((int)val[0]);
+			XFree(val);
+		}
+	}
+	else if (e->atom == atoms[NET_WM_STRUT_PARTIAL] || e->atom == atoms[NET_WM_STRUT]) {
+		Dock *d = dock_find(e->window);
+		if (d) {
+			dock_update_strut(d);
 		}
 	}
-	update_borders();
 }
 
-void hdl_motion(XEvent *xev)
+void hdl_unmap_ntf(XEvent *xev)
 {
-	XMotionEvent *e = &xev->xmotion;
+	Window w = xev->xunmap.window;
+	Client *c = find_client(w);
 
-	if ((drag_mode == DRAG_NONE || !drag_client) ||
-	    (e->time - last_motion_time <= (1000 / (long unsigned int)user_config.motion_throttle))) {
+	/* popups and tooltips are not ours, at most a dock went away */
+	if (!c) {
+		dock_remove(w);
+		return;
+	}
+	/* one of ours from hide_client(), the client still wants to be mapped */
+	if (c->ignore_unmap > 0) {
+		c->ignore_unmap--;
 		return;
 	}
-	last_motion_time = e->time;
 
-	if (drag_mode == DRAG_SWAP) {
-		Window root_ret, child;
-		int rx, ry, wx, wy;
-		unsigned int mask;
-		XQueryPointer(dpy, root, &root_ret, &child, &rx, &ry, &wx, &wy, &mask);
+	c->mapped = False;
+	ipc_client_event("unmap", c);
+	if (c->ws == current_ws) {
+		mark_dirty(DIRTY_LAYOUT | DIRTY_BORDERS);
+	}
+}
+
+/* events are read by the XPending() loop in run(), this only wakes it up */
+void hdl_xconn(int fd)
+{
+	(void)fd;
+}
 
-		Client *last_swap_target = NULL;
-		Client *new_target = NULL;
+void update_refresh_rates(void)
+{
+	for (int i = 0; i < monsn; i++) {
+		mons[i].refresh = 0;
+	}
+	if (!randr_ok) {
+		return;
+	}
 
-		for (Client *c = workspaces[current_ws]; c; c = c->next) {
-			if (c == drag_client || c->floating) {
+	COUNT(METRIC_ROUNDTRIP);
+	XRRScreenResources *res = XRRGetScreenResourcesCurrent(dpy, root);
+	if (!res) {
+		return;
+	}
+	for (int c = 0; c < res->ncrtc; c++) {
+		COUNT(METRIC_ROUNDTRIP);
+		XRRCrtcInfo *ci = XRRGetCrtcInfo(dpy, res, res->crtcs[c]);
+		if (!ci) {
+			continue;
+		}
+		for (int m = 0; ci->mode != None && m < res->nmode; m++) {
+			XRRModeInfo *mi = &res->modes[m];
+			if (mi->id != ci->mode || !mi->hTotal || !mi->vTotal) {
 				continue;
 			}
-			if (c->win == child) {
-				new_target = c;
-				break;
+			double vtotal = mi->vTotal;
+			if (mi->modeFlags & RR_DoubleScan) {
+				vtotal *= 2;
 			}
+			if (mi->modeFlags & RR_Interlace) {
+				vtotal /= 2;
+			}
+			int hz = (int)(mi->dotClock / (mi->hTotal * vtotal) + 0.5);
+
+			/* mirrored crtcs share a monitor, pace for the slowest */
+			for (int i = 0; i < monsn; i++) {
+				if (mons[i].x >= ci->x && mons[i].x < ci->x + (int)ci->width && mons[i].y >= ci->y &&
+				    mons[i].y < ci->y + (int)ci->height && (!mons[i].refresh || hz < mons[i].refresh)) {
+					mons[i].refresh = hz;
+				}
+			}
+			break;
 		}
+		XRRFreeCrtcInfo(ci);
+	}
+	XRRFreeScreenResources(res);
+}
 
-		if (new_target != last_swap_target) {
-			if (last_swap_target) {
-				XSetWindowBorder(
-				    dpy, last_swap_target->win,
-				    (last_swap_target == focused ? user_config.border_foc_col : user_config.border_ufoc_col));
+void update_struts(void)
+{
+	Bool changed = False;
+	dirty &= ~DIRTY_STRUTS;
+
+	for (int m = 0; m < monsn; m++) {
+		Monitor *mon = &mons[m];
+		int left = 0, right = 0, top = 0, bottom = 0;
+
+		/* struts are relative to the screen edges, the start/end ranges pick the monitors they cover */
+		for (Dock *d = docks; d; d = d->next) {
+			long *s = d->strut;
+			if (s[0] > 0 && s[4] < mon->y + mon->h && s[5] >= mon->y) {
+				left = MAX(left, (int)MIN(s[0] - mon->x, mon->w));
 			}
-			if (new_target) {
-				XSetWindowBorder(dpy, new_target->win, user_config.border_swap_col);
+			if (s[1] > 0 && s[6] < mon->y + mon->h && s[7] >= mon->y) {
+				right = MAX(right, (int)MIN(mon->x + mon->w - (scr_width - s[1]), mon->w));
+			}
+			if (s[2] > 0 && s[8] < mon->x + mon->w && s[9] >= mon->x) {
+				top = MAX(top, (int)MIN(s[2] - mon->y, mon->h));
+			}
+			if (s[3] > 0 && s[10] < mon->x + mon->w && s[11] >= mon->x) {
+				bottom = MAX(bottom, (int)MIN(mon->y + mon->h - (scr_height - s[3]), mon->h));
 			}
-			last_swap_target = new_target;
 		}
 
-		swap_target = new_target;
+		if (left != mon->reserve_left || right != mon->reserve_right || top != mon->reserve_top ||
+		    bottom != mon->reserve_bottom) {
+			mon->reserve_left = left;
+			mon->reserve_right = right;
+			mon->reserve_top = top;
+			mon->reserve_bottom = bottom;
+			changed = True;
+		}
+	}
+
+	/* only a real change in reserved space needs a relayout */
+	if (changed) {
+		update_workarea();
+		mark_dirty(DIRTY_LAYOUT | DIRTY_BORDERS);
+	}
+}
+
+void update_workarea(void)
+{
+	static long *last = NULL, *workarea = NULL;
+	static int last_cap = 0, workarea_cap = 0;
+	static int lastn = -1;
+	int n = monsn;
+
+	if (!grow_array((void **)&workarea, &workarea_cap, 4 * n, sizeof(long)) ||
+	    !grow_array((void **)&last, &last_cap, 4 * n, sizeof(long))) {
 		return;
 	}
 
-	else if (drag_mode == DRAG_MOVE) {
-		int dx = e->x_root - drag_start_x;
-		int dy = e->y_root - drag_start_y;
-		int nx = drag_orig_x + dx;
-		int ny = drag_orig_y + dy;
+	for (int i = 0; i < n; i++) {
+		workarea[i * 4 + 0] = mons[i].x + mons[i].reserve_left;
+		workarea[i * 4 + 1] = mons[i].y + mons[i].reserve_top;
+		workarea[i * 4 + 2] = mons[i].w - mons[i].reserve_left - mons[i].reserve_right;
+		workarea[i * 4 + 3] = mons[i].h - mons[i].reserve_top - mons[i].reserve_bottom;
+	}
 
-		int outer_w = drag_client->w + 2 * user_config.border_width;
-		int outer_h = drag_client->h + 2 * user_config.border_width;
+	if (n == lastn && !memcmp(workarea, last, n * 4 * sizeof(long))) {
+		return;
+	}
+	memcpy(last, workarea, n * 4 * sizeof(long));
+	lastn = n;
+	XChangeProperty(dpy, root, atoms[NET_WORKAREA], XA_CARDINAL, 32, PropModeReplace, (unsigned char *)workarea,
+	                n * 4);
+}
 
-		if (UDIST(nx, 0) <= user_config.snap_distance) {
-			nx = 0;
+void inc_gaps(void)
+{
+	user_config.gaps++;
+	mark_dirty(DIRTY_LAYOUT | DIRTY_BORDERS);
+}
+
+void inc_nmaster(void)
+{
+	ws_nmaster[current_ws]++;
+	mark_dirty(DIRTY_LAYOUT | DIRTY_BORDERS);
+}
+
+void init_defaults(void)
+{
+	default_config.modkey = Mod4Mask;
+	default_config.gaps = 10;
+	default_config.border_width = 1;
+	default_config.border_foc_col = parse_col("#c0cbff");
+	default_config.border_ufoc_col = parse_col("#555555");
+	default_config.border_swap_col = parse_col("#fff4c0");
+	default_config.master_width = 50 / 100.0f;
+
+	default_config.motion_throttle = 0;
+	default_config.nmaster = 1;
+	default_config.layout = LAYOUT_TILE;
+	default_config.resize_master_amt = 5;
+	default_config.resize_stack_amt = 20;
+	default_config.snap_distance = 5;
+	default_config.bindsn = 0;
+	default_config.new_win_focus = True;
+	default_config.warp_cursor = True;
+	default_config.park_hidden = False;
+
+	if (backup_binds) {
+		for (unsigned long i = 0; i < LENGTH(binds); i++) {
+			default_config.binds[i].mods = binds[i].mods;
+			default_config.binds[i].keysym = binds[i].keysym;
+			default_config.binds[i].action.cmd = binds[i].action.cmd;
+			default_config.binds[i].type = binds[i].type;
+			default_config.bindsn++;
 		}
-		else if (UDIST(nx + outer_w, scr_width) <= user_config.snap_distance) {
-			nx = scr_width - outer_w;
+	}
+
+	user_config = default_config;
+}
+
+void ipc_cleanup(void)
+{
+	if (ipc_fd >= 0) {
+		close(ipc_fd);
+		unlink(ipc_addr.sun_path);
+		ipc_fd = -1;
+	}
+}
+
+void ipc_client_event(const char *what, Client *c)
+{
+	ipc_event(EV_CLIENT, "%s 0x%lx %d %d\n", what, c->win, c->ws + 1, c->mon + 1);
+}
+
+void ipc_close(int fd)
+{
+	loop_remove(fd);
+	close(fd);
+	Bool subscribed = ipc_conns[fd].events != 0;
+	free(ipc_conns[fd].in.data);
+	free(ipc_conns[fd].out.data);
+	ipc_conns[fd] = (IpcConn){0};
+
+	if (subscribed) {
+		ipc_sub_mask = 0;
+		for (int i = 0; i < ipc_conns_cap; i++) {
+			ipc_sub_mask |= ipc_conns[i].events;
 		}
+	}
+}
 
-		if (UDIST(ny, 0) <= user_config.snap_distance) {
-			ny = 0;
+/* queue a line for every subscriber of this event class, sent by ipc_flush() */
+void ipc_event(unsigned int ev, const char *fmt, ...)
+{
+	if (!(ipc_sub_mask & ev)) {
+		return;
+	}
+
+	char line[256];
+	va_list ap;
+	va_start(ap, fmt);
+	int n = vsnprintf(line, sizeof line, fmt, ap);
+	va_end(ap);
+	if (n <= 0) {
+		return;
+	}
+	n = MIN(n, (int)sizeof line - 1);
+
+	for (int fd = 0; fd < ipc_conns_cap; fd++) {
+		IpcConn *conn = &ipc_conns[fd];
+		if (!(conn->events & ev)) {
+			continue;
 		}
-		else if (UDIST(ny + outer_h, scr_height) <= user_config.snap_distance) {
-			ny = scr_height - outer_h;
+		/* a consumer this far behind is dropped, buffering more would only grow without bound */
+		if (conn->out.len + n > IPC_SUB_MAX) {
+			ipc_close(fd);
+			continue;
 		}
+		buf_append(&conn->out, line, n);
+		ipc_pending = True;
+	}
+}
 
-		if (!drag_client->floating && (UDIST(nx, drag_client->x) > user_config.snap_distance ||
-		                               UDIST(ny, drag_client->y) > user_config.snap_distance)) {
-			toggle_floating();
-		}
+/* run one command from a message, every command answers with at least one line */
+void ipc_exec(char *cmd, Buf *out)
+{
+	char *arg = cmd + strcspn(cmd, " \t");
+	if (*arg) {
+		*arg++ = '\0';
+		arg += strspn(arg, " \t");
+	}
 
-		XMoveWindow(dpy, drag_client->win, nx, ny);
-		drag_client->x = nx;
-		drag_client->y = ny;
+	int n;
+	if (!strcmp(cmd, "query")) {
+		ipc_query(arg, out);
+	}
+	else if (!strcmp(cmd, "set")) {
+		ipc_set(arg, out);
+	}
+	else if (!strcmp(cmd, "layout")) {
+		int l = layout_from_name(arg);
+		if (l < 0) {
+			buf_printf(out, "error: unknown layout '%s'\n", arg);
+			return;
+		}
+		set_layout(l);
+		buf_printf(out, "ok\n");
+	}
+	else if (!strcmp(cmd, "workspace")) {
+		if (sscanf(arg, "move %d", &n) == 1 && n >= 1 && n <= NUM_WORKSPACES) {
+			change_workspace(n - 1);
+		}
+		else if (sscanf(arg, "swap %d", &n) == 1 && n >= 1 && n <= NUM_WORKSPACES) {
+			move_to_workspace(n - 1);
+		}
+		else {
+			buf_printf(out, "error: invalid workspace action '%s'\n", arg);
+			return;
+		}
+		buf_printf(out, "ok\n");
 	}
+	else {
+		void (*fn)(void) = action_from_name(cmd);
+		if (!fn || *arg) {
+			buf_printf(out, "error: unknown command '%s'\n", cmd);
+			return;
+		}
+		fn();
+		buf_printf(out, "ok\n");
+	}
+}
 
-	else if (drag_mode == DRAG_RESIZE) {
-		int dx = e->x_root - drag_start_x;
-		int dy = e->y_root - drag_start_y;
-		int nw = drag_orig_w + dx;
-		int nh = drag_orig_h + dy;
-		drag_client->w = nw < 20 ? 20 : nw;
-		drag_client->h = nh < 20 ? 20 : nh;
-		XResizeWindow(dpy, drag_client->win, drag_client->w, drag_client->h);
+void ipc_flush(void)
+{
+	if (!ipc_pending) {
+		return;
+	}
+	ipc_pending = False;
+	for (int fd = 0; fd < ipc_conns_cap; fd++) {
+		if (ipc_conns[fd].events && ipc_conns[fd].out.len) {
+			ipc_sub_write(fd);
+		}
 	}
 }
 
-void hdl_root_property(XEvent *xev)
+void ipc_query(const char *what, Buf *out)
 {
-	XPropertyEvent *e = &xev->xproperty;
-	if (e->atom == atom_net_current_desktop) {
-		long *val = NULL;
-		Atom actual;
-		int fmt;
-		unsigned long n, after;
-		if (XGetWindowProperty(dpy, root, atom_net_current_desktop, 0, 1, False, XA_CARDINAL, &actual, &fmt, &n, &after,
-		                       (unsigned char **)&val) == Success &&
-		    val) {
-			change_workspace((int)val[0]);
-			XFree(val);
+	if (!strcmp(what, "clients")) {
+		/* window workspace monitor x y w h state */
+		for (int ws = 0; ws < NUM_WORKSPACES; ws++) {
+			for (Client *c = workspaces[ws]; c; c = c->next) {
+				buf_printf(out, "0x%lx %d %d %d %d %d %d %s\n", c->win, ws + 1, c->mon + 1, c->x, c->y, c->w, c->h,
+				           c->fullscreen ? "fullscreen" : c->floating ? "floating" : "tiled");
+			}
 		}
 	}
-	else if (e->atom == atom_wm_strut_partial) {
-		update_struts();
-		tile();
-		update_borders();
+	else if (!strcmp(what, "focused")) {
+		if (focused) {
+			buf_printf(out, "0x%lx\n", focused->win);
+		}
+		else {
+			buf_printf(out, "none\n");
+		}
+	}
+	else if (!strncmp(what, "geometry", 8)) {
+		/* of the focused window, or of the one given as the argument */
+		Client *c = focused;
+		unsigned long w;
+		if (sscanf(what + 8, " %lx", &w) == 1) {
+			c = find_client(w);
+		}
+		if (!c) {
+			buf_printf(out, "error: no such window\n");
+			return;
+		}
+		buf_printf(out, "%d %d %d %d\n", c->x, c->y, c->w, c->h);
+	}
+	else if (!strcmp(what, "metrics")) {
+		metrics_dump(out);
+	}
+	else if (!strcmp(what, "monitors")) {
+		/* index x y w h refresh, the current one marked */
+		for (int i = 0; i < monsn; i++) {
+			buf_printf(out, "%d %d %d %d %d %d%s\n", i + 1, mons[i].x, mons[i].y, mons[i].w, mons[i].h,
+			           mons[i].refresh, i == current_monitor ? " current" : "");
+		}
+	}
+	else if (!strcmp(what, "workspace")) {
+		buf_printf(out, "%d %s\n", current_ws + 1, layouts[ws_layout[current_ws]].name);
+	}
+	else {
+		buf_printf(out, "error: unknown query '%s'\n", what);
 	}
 }
 
-void hdl_unmap_ntf(XEvent *xev)
+/* whatever the socket does not take now is sent from the loop, the connection closes once it drains */
+void ipc_reply(int fd, const char *data, int len)
 {
-	if (!in_ws_switch) {
-		Window w = xev->xunmap.window;
-		for (Client *c = workspaces[current_ws]; c; c = c->next) {
-			if (c->win == w) {
-				c->mapped = False;
-				break;
-			}
+	IpcConn *conn = &ipc_conns[fd];
+	free(conn->in.data);
+	conn->in = (Buf){0};
+	buf_append(&conn->out, data, len);
+	ipc_sub_write(fd);
+}
+
+/* the whole message is one transaction, the batch is laid out once by flush_dirty() afterwards */
+void ipc_run(int fd)
+{
+	IpcConn *conn = &ipc_conns[fd];
+	Buf out = {0};
+	unsigned int events = 0;
+	buf_append(&conn->in, "", 1);
+
+	char *save;
+	ipc_batch = True;
+	for (char *cmd = strtok_r(conn->in.data, ";\n", &save); cmd && running; cmd = strtok_r(NULL, ";\n", &save)) {
+		cmd += strspn(cmd, " \t");
+		char *end = cmd + strlen(cmd);
+		while (end > cmd && isspace((unsigned char)end[-1])) {
+			*--end = '\0';
+		}
+		if (!strncmp(cmd, "subscribe", 9) && (!cmd[9] || isspace((unsigned char)cmd[9]))) {
+			events |= ipc_subscribe(cmd + 9, &out);
+		}
+		else if (*cmd) {
+			ipc_exec(cmd, &out);
 		}
 	}
+	ipc_batch = False;
 
-	update_net_client_list();
-	tile();
-	update_borders();
+	/* without a subscription the connection closes once the replies are sent */
+	free(conn->in.data);
+	conn->in = (Buf){0};
+	conn->out = out;
+	if (events) {
+		/* it stays open as an event stream that starts with the replies */
+		conn->events = events;
+		ipc_sub_mask |= events;
+	}
+	ipc_sub_write(fd);
 }
 
-void update_struts(void)
+void ipc_set(char *arg, Buf *out)
 {
-	reserve_left = reserve_right = reserve_top = reserve_bottom = 0;
+	const struct {
+		const char *key;
+		int *val;
+		unsigned int dirty;
+	} ints[] = {
+	    {"gaps", &user_config.gaps, DIRTY_LAYOUT},
+	    {"border_width", &user_config.border_width, DIRTY_LAYOUT},
+	    {"motion_throttle", &user_config.motion_throttle, 0},
+	    {"resize_master_amount", &user_config.resize_master_amt, 0},
+	    {"resize_stack_amount", &user_config.resize_stack_amt, 0},
+	    {"snap_distance", &user_config.snap_distance, 0},
+	};
+	const struct {
+		const char *key;
+		Bool *val;
+	} bools[] = {
+	    {"new_win_focus", &user_config.new_win_focus},
+	    {"warp_cursor", &user_config.warp_cursor},
+	    {"park_hidden_windows", &user_config.park_hidden},
+	};
+	const struct {
+		const char *key;
+		long *val;
+	} cols[] = {
+	    {"focused_border_colour", &user_config.border_foc_col},
+	    {"unfocused_border_colour", &user_config.border_ufoc_col},
+	    {"swap_border_colour", &user_config.border_swap_col},
+	};
 
-	Window root_ret, parent_ret, *children;
-	unsigned int nchildren;
-	if (!XQueryTree(dpy, root, &root_ret, &parent_ret, &children, &nchildren)) {
+	char *val = arg + strcspn(arg, " \t");
+	if (*val) {
+		*val++ = '\0';
+		val += strspn(val, " \t");
+	}
+	if (!*val) {
+		buf_printf(out, "error: set %s needs a value\n", arg);
 		return;
 	}
 
-	for (unsigned int i = 0; i < nchildren; i++) {
-		Window w = children[i];
+	/* every number here is a non-negative int, anything else is refused rather than read as 0 */
+	char *end;
+	errno = 0;
+	long num = strtol(val, &end, 10);
+	Bool is_num = end != val && !*end && !errno && num >= 0 && num <= INT_MAX;
 
-		Atom actual_type;
-		int actual_format;
-		unsigned long nitems, bytes_after;
-		Atom *types = NULL;
+	for (size_t i = 0; i < LENGTH(ints); i++) {
+		if (!strcmp(arg, ints[i].key)) {
+			if (!is_num) {
+				buf_printf(out, "error: set %s needs a non-negative number, not '%s'\n", arg, val);
+				return;
+			}
+			*ints[i].val = (int)num;
+			mark_dirty(ints[i].dirty);
+			buf_printf(out, "ok\n");
+			return;
+		}
+	}
+	for (size_t i = 0; i < LENGTH(bools); i++) {
+		if (!strcmp(arg, bools[i].key)) {
+			if (strcmp(val, "true") && strcmp(val, "false")) {
+				buf_printf(out, "error: set %s needs true or false, not '%s'\n", arg, val);
+				return;
+			}
+			*bools[i].val = !strcmp(val, "true");
+			buf_printf(out, "ok\n");
+			return;
+		}
+	}
+	for (size_t i = 0; i < LENGTH(cols); i++) {
+		if (!strcmp(arg, cols[i].key)) {
+			*cols[i].val = parse_col(val);
+			borders_stale = True;
+			mark_dirty(DIRTY_BORDERS);
+			buf_printf(out, "ok\n");
+			return;
+		}
+	}
 
-		if (XGetWindowProperty(dpy, w, atom_wm_window_type, 0, 4, False, XA_ATOM, &actual_type, &actual_format, &nitems,
-		                       &bytes_after, (unsigned char **)&types) != Success ||
-		    !types) {
-			continue;
+	/* like a reload with a new default, every monitor and workspace takes it */
+	if ((!strcmp(arg, "master_width") || !strcmp(arg, "master_count")) && !is_num) {
+		buf_printf(out, "error: set %s needs a non-negative number, not '%s'\n", arg, val);
+		return;
+	}
+	if (!strcmp(arg, "master_width")) {
+		user_config.master_width = CLAMP(num / 100.0f, MF_MIN, MF_MAX);
+		for (int i = 0; i < monsn; i++) {
+			mons[i].mf = user_config.master_width;
 		}
+	}
+	else if (!strcmp(arg, "master_count")) {
+		user_config.nmaster = (int)num;
+		for (int i = 0; i < NUM_WORKSPACES; i++) {
+			ws_nmaster[i] = user_config.nmaster;
+		}
+	}
+	else {
+		buf_printf(out, "error: unknown option '%s'\n", arg);
+		return;
+	}
+	mark_dirty(DIRTY_LAYOUT);
+	buf_printf(out, "ok\n");
+}
 
-		Bool is_dock = False;
-		for (unsigned long j = 0; j < nitems; j++) {
-			if (types[j] == atom_net_wm_window_type_dock) {
-				is_dock = True;
-				break;
+/* report what changed since the last batch, so a burst of switches costs one event */
+void ipc_state_events(void)
+{
+	if (seen_ws != current_ws) {
+		seen_ws = current_ws;
+		ipc_event(EV_WORKSPACE, "workspace %d\n", current_ws + 1);
+	}
+	if (seen_mon != current_monitor) {
+		seen_mon = current_monitor;
+		ipc_event(EV_MONITOR, "monitor %d\n", current_monitor + 1);
+	}
+	Window f = focused ? focused->win : None;
+	if (seen_focus != f) {
+		seen_focus = f;
+		if (f) {
+			ipc_event(EV_FOCUS, "focus 0x%lx\n", f);
+		}
+		else {
+			ipc_event(EV_FOCUS, "focus none\n");
+		}
+	}
+	for (int ws = 0; ws < NUM_WORKSPACES; ws++) {
+		if (seen_layout[ws] != ws_layout[ws]) {
+			seen_layout[ws] = ws_layout[ws];
+			ipc_event(EV_LAYOUT, "layout %d %s\n", ws + 1, layouts[ws_layout[ws]].name);
+		}
+	}
+}
+
+/* parse "subscribe [class...]" and answer with the current state of each class */
+unsigned int ipc_subscribe(char *arg, Buf *out)
+{
+	static const struct {
+		const char *name;
+		unsigned int ev;
+	} classes[] = {
+		{"workspace", EV_WORKSPACE}, {"focus", EV_FOCUS}, {"client", EV_CLIENT},
+		{"monitor", EV_MONITOR},     {"layout", EV_LAYOUT}, {"all", EV_ALL},
+	};
+
+	unsigned int events = 0;
+	char *save;
+	for (char *w = strtok_r(arg, " \t", &save); w; w = strtok_r(NULL, " \t", &save)) {
+		unsigned int ev = 0;
+		for (size_t i = 0; i < LENGTH(classes); i++) {
+			if (!strcmp(w, classes[i].name)) {
+				ev = classes[i].ev;
 			}
 		}
-		XFree(types);
-		if (!is_dock) {
-			continue;
+		if (!ev) {
+			buf_printf(out, "error: unknown event class '%s'\n", w);
+			return 0;
 		}
+		events |= ev;
+	}
+	if (!events) {
+		events = EV_ALL;
+	}
 
-		long *str = NULL;
-		Atom actual;
-		int sfmt;
-		unsigned long len, rem;
-		if (XGetWindowProperty(dpy, w, atom_wm_strut_partial, 0, 12, False, XA_CARDINAL, &actual, &sfmt, &len, &rem,
-		                       (unsigned char **)&str) == Success &&
-		    str && len >= 4) {
-			reserve_left = MAX(reserve_left, str[0]);
-			reserve_right = MAX(reserve_right, str[1]);
-			reserve_top = MAX(reserve_top, str[2]);
-			reserve_bottom = MAX(reserve_bottom, str[3]);
-			XFree(str);
-		}
-		else if (XGetWindowProperty(dpy, w, atom_wm_strut, 0, 4, False, XA_CARDINAL, &actual, &sfmt, &len, &rem,
-		                            (unsigned char **)&str) == Success &&
-		         str && len == 4) {
-			reserve_left = MAX(reserve_left, str[0]);
-			reserve_right = MAX(reserve_right, str[1]);
-			reserve_top = MAX(reserve_top, str[2]);
-			reserve_bottom = MAX(reserve_bottom, str[3]);
-			XFree(str);
+	buf_printf(out, "ok\n");
+	if (events & EV_WORKSPACE) {
+		buf_printf(out, "workspace %d\n", current_ws + 1);
+	}
+	if (events & EV_MONITOR) {
+		buf_printf(out, "monitor %d\n", current_monitor + 1);
+	}
+	if (events & EV_FOCUS) {
+		if (focused) {
+			buf_printf(out, "focus 0x%lx\n", focused->win);
+		}
+		else {
+			buf_printf(out, "focus none\n");
 		}
 	}
-	XFree(children);
+	if (events & EV_LAYOUT) {
+		buf_printf(out, "layout %d %s\n", current_ws + 1, layouts[ws_layout[current_ws]].name);
+	}
+	return events;
 }
 
-void update_workarea(void)
+/* send what the socket takes without blocking, wait for EPOLLOUT for the rest */
+void ipc_sub_write(int fd)
+{
+	Buf *b = &ipc_conns[fd].out;
+	int sent = 0;
+	while (sent < b->len) {
+		ssize_t n = send(fd, b->data + sent, b->len - sent, MSG_NOSIGNAL);
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		}
+		if (n <= 0) {
+			ipc_close(fd);
+			return;
+		}
+		sent += n;
+	}
+
+	if (sent) {
+		memmove(b->data, b->data + sent, b->len - sent);
+		b->len -= sent;
+	}
+	if (!b->len && !ipc_conns[fd].events) {
+		ipc_close(fd);
+		return;
+	}
+	loop_set(fd, hdl_ipc_sub, b->len ? LOOP_OUT : 0);
+}
+
+/* $XDG_RUNTIME_DIR/sxwm-$DISPLAY.sock, keep in sync with socket_path() in sxwmc.c */
+void ipc_socket_path(char *out, size_t n)
 {
-	long workarea[4 * MAX_MONITORS];
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	const char *display = getenv("DISPLAY");
+	char disp[64];
+	snprintf(disp, sizeof disp, "%s", display ? display : ":0");
+	for (char *p = disp; *p; p++) {
+		if (*p == '/') {
+			*p = '_';
+		}
+	}
 
-	for (int i = 0; i < monsn && i < MAX_MONITORS; i++) {
-		workarea[i * 4 + 0] = mons[i].x + reserve_left;
-		workarea[i * 4 + 1] = mons[i].y + reserve_top;
-		workarea[i * 4 + 2] = mons[i].w - reserve_left - reserve_right;
-		workarea[i * 4 + 3] = mons[i].h - reserve_top - reserve_bottom;
+	if (dir && *dir) {
+		snprintf(out, n, "%s/sxwm-%s.sock", dir, disp);
+	}
+	else {
+		snprintf(out, n, "/tmp/sxwm-%d-%s.sock", (int)getuid(), disp);
 	}
-	XChangeProperty(dpy, root, atom_net_workarea, XA_CARDINAL, 32, PropModeReplace, (unsigned char *)workarea,
-	                monsn * 4);
 }
 
-void inc_gaps(void)
+const Rect *layout_arrange(int ws, int m, int layout, const LayoutParams *lp)
 {
-	user_config.gaps++;
-	tile();
-	update_borders();
+	LayoutCache *lc = &mons[m].cache[ws];
+	const LayoutParams *k = &lc->key;
+	Bool hit = lc->valid && lc->layout == layout && k->n == lp->n && k->nmaster == lp->nmaster &&
+	           k->gaps == lp->gaps && k->border_width == lp->border_width && k->mf == lp->mf &&
+	           k->area.x == lp->area.x && k->area.y == lp->area.y && k->area.w == lp->area.w &&
+	           k->area.h == lp->area.h && !k->custom == !lp->custom;
+
+	if (hit && lp->custom) {
+		hit = memcmp(lc->custom, lp->custom, lp->n * sizeof(int)) == 0;
+	}
+	if (hit) {
+		return lc->geom;
+	}
+
+	if (!grow_array((void **)&lc->geom, &lc->geom_cap, lp->n, sizeof(Rect)) ||
+	    !grow_array((void **)&lc->custom, &lc->custom_cap, lp->n, sizeof(int))) {
+		lc->valid = False;
+		return NULL;
+	}
+
+	layouts[layout].arrange(lp, lc->geom);
+
+	lc->valid = True;
+	lc->layout = layout;
+	lc->key = *lp;
+	if (lp->custom) {
+		memcpy(lc->custom, lp->custom, lp->n * sizeof(int));
+		lc->key.custom = lc->custom;
+	}
+	return lc->geom;
 }
 
-void init_defaults(void)
+void loop_add(int fd, FdHandler fn)
+{
+	int old_cap = loop_fds_cap;
+	if (!grow_array((void **)&loop_fds, &loop_fds_cap, fd + 1, sizeof *loop_fds)) {
+		return;
+	}
+	for (int i = old_cap; i < loop_fds_cap; i++) {
+		loop_fds[i] = (LoopFd){0};
+	}
+	loop_fds[fd] = (LoopFd){.fn = fn, .events = LOOP_IN};
+
+#ifdef __linux__
+	struct epoll_event ev = {.events = EPOLLIN, .data.fd = fd};
+	if (epoll_ctl(loop_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		warn("epoll_ctl add %d", fd);
+	}
+#endif
+}
+
+void loop_set(int fd, FdHandler fn, unsigned int events)
+{
+	if (fd < 0 || fd >= loop_fds_cap || !loop_fds[fd].fn) {
+		return;
+	}
+	if (loop_fds[fd].fn == fn && loop_fds[fd].events == events) {
+		return;
+	}
+	loop_fds[fd] = (LoopFd){.fn = fn, .events = events};
+
+#ifdef __linux__
+	struct epoll_event ev = {.data.fd = fd};
+	ev.events = ((events & LOOP_IN) ? EPOLLIN : 0) | ((events & LOOP_OUT) ? EPOLLOUT : 0);
+	if (epoll_ctl(loop_fd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+		warn("epoll_ctl mod %d", fd);
+	}
+#endif
+}
+
+void loop_remove(int fd)
+{
+	if (fd < 0 || fd >= loop_fds_cap || !loop_fds[fd].fn) {
+		return;
+	}
+	loop_fds[fd] = (LoopFd){0};
+#ifdef __linux__
+	epoll_ctl(loop_fd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+}
+
+/* sleep until some fd is ready and run its handler, never busy-waits */
+void loop_wait(void)
+{
+#ifdef __linux__
+	struct epoll_event evs[16];
+	int n = epoll_wait(loop_fd, evs, LENGTH(evs), -1);
+	if (n < 0 && errno != EINTR) {
+		err(EXIT_FAILURE, "epoll_wait");
+	}
+	for (int i = 0; i < n; i++) {
+		int fd = evs[i].data.fd;
+		/* an earlier handler in this batch may have dropped it */
+		if (fd < loop_fds_cap && loop_fds[fd].fn) {
+			loop_fds[fd].fn(fd);
+		}
+	}
+#else
+	static struct pollfd *fds = NULL;
+	static int fds_cap = 0;
+	int n = 0;
+	if (!grow_array((void **)&fds, &fds_cap, loop_fds_cap, sizeof *fds)) {
+		return;
+	}
+	for (int fd = 0; fd < loop_fds_cap; fd++) {
+		if (loop_fds[fd].fn) {
+			short events = ((loop_fds[fd].events & LOOP_IN) ? POLLIN : 0) |
+			               ((loop_fds[fd].events & LOOP_OUT) ? POLLOUT : 0);
+			fds[n++] = (struct pollfd){.fd = fd, .events = events};
+		}
+	}
+
+	/* no timerfd here, the nearest timer becomes the poll timeout */
+	int timeout = -1;
+	long now = now_ms();
+	for (int i = 0; i < TIMER_COUNT; i++) {
+		if (timers[i] && (timeout < 0 || timers[i] - now < timeout)) {
+			timeout = (int)MAX(0, timers[i] - now);
+		}
+	}
+
+	if (poll(fds, n, timeout) < 0 && errno != EINTR) {
+		err(EXIT_FAILURE, "poll");
+	}
+	for (int i = 0; i < n; i++) {
+		if ((fds[i].revents & (POLLIN | POLLOUT | POLLHUP | POLLERR)) && loop_fds[fds[i].fd].fn) {
+			loop_fds[fds[i].fd].fn(fds[i].fd);
+		}
+	}
+	timers_run();
+#endif
+}
+
+/* manage a window that asked to be mapped, or that was already mapped when sxwm started */
+Client *manage_window(WinInfo *wi, Bool adopt)
+{
+	if (wi->override_redirect || wi->w <= 0 || wi->h <= 0 || wi->is_dock) {
+		if (wi->is_dock) {
+			dock_add(wi);
+		}
+		XMapWindow(dpy, wi->win);
+		return NULL;
+	}
+
+	/* rules are applied before the window is first mapped */
+	const Rule *rule = rule_match(wi);
+	Bool should_float = wi->float_type || wi->transient_for || (rule && rule->floating);
+	Bool fixed = !should_float && wi->hints.min_w && wi->hints.min_w == wi->hints.max_w &&
+	             wi->hints.min_h && wi->hints.min_h == wi->hints.max_h;
+	int ws = rule && rule->ws >= 0 ? rule->ws : current_ws;
+	/* an adopted window goes back to the desktop it had before */
+	if (adopt && wi->desktop >= 0 && wi->desktop < NUM_WORKSPACES) {
+		ws = wi->desktop;
+	}
+
+	Client *c = add_client(wi, ws);
+	if (!c) {
+		return NULL;
+	}
+
+	/* dialogs open over their parent rather than under the pointer */
+	Client *parent = c->transient_for ? find_client(c->transient_for) : NULL;
+	if (parent) {
+		c->mon = parent->mon;
+	}
+	if (rule && rule->mon >= 0 && rule->mon < monsn && !adopt) {
+		c->mon = rule->mon;
+	}
+
+	if (fixed) {
+		should_float = True;
+		c->fixed = True;
+	}
+
+	if (should_float || global_floating) {
+		c->floating = True;
+	}
+
+	/* center floating windows & set border, adopted ones stay where they are */
+	if (c->floating && !c->fullscreen && !adopt) {
+		int w_ = MAX(c->w, 64), h_ = MAX(c->h, 64);
+		int mx = mons[c->mon].x, my = mons[c->mon].y;
+		int mw = mons[c->mon].w, mh = mons[c->mon].h;
+		int x = mx + (mw - w_) / 2, y = my + (mh - h_) / 2;
+		if (rule && rule->has_geom) {
+			x = mx + rule->x;
+			y = my + rule->y;
+			w_ = rule->w;
+			h_ = rule->h;
+		}
+		c->x = x;
+		c->y = y;
+		c->w = w_;
+		c->h = h_;
+		XMoveResizeWindow(dpy, wi->win, x, y, w_, h_);
+		COUNT(METRIC_CONFIGURE);
+	}
+	if (c->floating) {
+		XSetWindowBorderWidth(dpy, wi->win, user_config.border_width);
+	}
+
+	/* never mapped here, show_client() maps it on the first switch to its workspace */
+	if (ws != current_ws) {
+		c->mapped = True;
+		/* windows handed over by restart() on other workspaces are already hidden */
+		if (adopt && wi->map_state == IsViewable) {
+			hide_client(c);
+		}
+		return c;
+	}
+
+	c->mapped = True;
+	if (!c->floating) {
+		mark_dirty(DIRTY_LAYOUT);
+	}
+	else {
+		raise_client(c);
+	}
+	mark_dirty(DIRTY_BORDERS);
+	/* already on screen, adopt_windows() picks the focus once they are all in */
+	if (adopt) {
+		return c;
+	}
+
+	/* mapped by flush_dirty() once the batch has been laid out */
+	mark_dirty(DIRTY_MAP);
+	c->map_pending = True;
+
+	Bool take_focus = user_config.new_win_focus;
+	if (rule && rule->focus != FOCUS_DEFAULT) {
+		take_focus = rule->focus == FOCUS_ALWAYS;
+	}
+	if (take_focus) {
+		focused = c;
+		mark_dirty(DIRTY_FOCUS);
+		if (user_config.warp_cursor) {
+			warp_cursor(c);
+		}
+	}
+	return c;
+}
+
+void mark_dirty(unsigned int flags)
+{
+	dirty |= flags;
+}
+
+long now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+long now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000L;
+}
+
+void hist_add(Histogram *h, long us)
+{
+	int b = 0;
+	while (b < HIST_BUCKETS - 1 && us >= (1L << b)) {
+		b++;
+	}
+	h->buckets[b]++;
+	h->count++;
+	h->total_us += us;
+	h->max_us = MAX(h->max_us, us);
+}
+
+/* upper bound of the bucket holding the given quantile, exact to a factor of two */
+long hist_quantile(const Histogram *h, int permille)
 {
-	default_config.modkey = Mod4Mask;
-	default_config.gaps = 10;
-	default_config.border_width = 1;
-	default_config.border_foc_col = parse_col("#c0cbff");
-	default_config.border_ufoc_col = parse_col("#555555");
-	default_config.border_swap_col = parse_col("#fff4c0");
-	for (int i = 0; i < MAX_MONITORS; i++) {
-		default_config.master_width[i] = 50 / 100.0f;
+	unsigned long want = (h->count * permille + 999) / 1000, seen = 0;
+	for (int b = 0; b < HIST_BUCKETS; b++) {
+		seen += h->buckets[b];
+		if (seen >= want) {
+			return MIN(1L << b, h->max_us);
+		}
 	}
+	return h->max_us;
+}
 
-	default_config.motion_throttle = 60;
-	default_config.resize_master_amt = 5;
-	default_config.resize_stack_amt = 20;
-	default_config.snap_distance = 5;
-	default_config.bindsn = 0;
-	default_config.new_win_focus = True;
-	default_config.warp_cursor = True;
+void metrics_dump(Buf *b)
+{
+	static const char *event_names[LASTEvent + 1] = {
+		[KeyPress] = "KeyPress",
+		[ButtonPress] = "ButtonPress",
+		[ButtonRelease] = "ButtonRelease",
+		[MotionNotify] = "MotionNotify",
+		[EnterNotify] = "EnterNotify",
+		[LeaveNotify] = "LeaveNotify",
+		[FocusIn] = "FocusIn",
+		[FocusOut] = "FocusOut",
+		[DestroyNotify] = "DestroyNotify",
+		[UnmapNotify] = "UnmapNotify",
+		[MapNotify] = "MapNotify",
+		[MapRequest] = "MapRequest",
+		[ConfigureNotify] = "ConfigureNotify",
+		[ConfigureRequest] = "ConfigureRequest",
+		[PropertyNotify] = "PropertyNotify",
+		[ClientMessage] = "ClientMessage",
+		[MappingNotify] = "MappingNotify",
+		[LASTEvent] = "RandR",
+	};
 
-	if (backup_binds) {
-		for (unsigned long i = 0; i < LENGTH(binds); i++) {
-			default_config.binds[i].mods = binds[i].mods;
-			default_config.binds[i].keysym = binds[i].keysym;
-			default_config.binds[i].action.cmd = binds[i].action.cmd;
-			default_config.binds[i].type = binds[i].type;
-			default_config.bindsn++;
+	/* name p50 p99 max in microseconds, quantiles are bucket upper bounds */
+	for (int i = 0; i <= LASTEvent; i++) {
+		const Histogram *h = &event_hist[i];
+		if (h->count) {
+			char num[16];
+			snprintf(num, sizeof num, "%d", i);
+			buf_printf(b, "event %s %lu %ld %ld %ld\n", event_names[i] ? event_names[i] : num, h->count,
+			           hist_quantile(h, 500), hist_quantile(h, 990), h->max_us);
+		}
+	}
+	if (spawn_hist.count) {
+		buf_printf(b, "spawn_us %lu %ld %ld %ld\n", spawn_hist.count, hist_quantile(&spawn_hist, 500),
+		           hist_quantile(&spawn_hist, 990), spawn_hist.max_us);
+	}
+	for (int i = 0; i < METRIC_COUNT; i++) {
+		buf_printf(b, "counter %s %lu\n", metric_names[i], metrics[i]);
+	}
+	/* every atom is interned once by setup_atoms(), anything after that is a regression */
+	buf_printf(b, "counter atom_requests_after_startup %lu\n", metrics[METRIC_ATOMS] - startup_atom_requests);
+	/* the names come from the local Xlib error database, no round-trip */
+	for (int i = 0; i < 256; i++) {
+		if (xerrors[i]) {
+			char num[8], name[64];
+			snprintf(num, sizeof num, "%d", i);
+			XGetErrorDatabaseText(dpy, "XRequest", num, num, name, sizeof name);
+			buf_printf(b, "xerror %s %lu\n", name, xerrors[i]);
 		}
 	}
+}
 
-	user_config = default_config;
+/* clean_mask() leaves shift, control, mod1, mod4 and mod5, packed into 5 bits */
+int mod_index(int mask)
+{
+	mask = clean_mask(mask);
+	return (mask & ShiftMask ? 1 : 0) | (mask & ControlMask ? 2 : 0) | (mask & Mod1Mask ? 4 : 0) |
+	       (mask & Mod4Mask ? 8 : 0) | (mask & Mod5Mask ? 16 : 0);
+}
+
+int mod_mask(int index)
+{
+	return (index & 1 ? ShiftMask : 0) | (index & 2 ? ControlMask : 0) | (index & 4 ? Mod1Mask : 0) |
+	       (index & 8 ? Mod4Mask : 0) | (index & 16 ? Mod5Mask : 0);
 }
 
 void move_master_next(void)
@@ -1339,14 +3055,14 @@ void move_master_next(void)
 	}
 	tail->next = first;
 
-	tile();
+	mark_dirty(DIRTY_LAYOUT);
 	if (user_config.warp_cursor && old_focused) {
 		warp_cursor(old_focused);
 	}
 	if (old_focused) {
-		send_wm_take_focus(old_focused->win);
+		send_wm_take_focus(old_focused);
 	}
-	update_borders();
+	mark_dirty(DIRTY_BORDERS);
 }
 
 void move_master_prev(void)
@@ -1370,14 +3086,38 @@ void move_master_prev(void)
 	cur->next = workspaces[current_ws];
 	workspaces[current_ws] = cur;
 
-	tile();
+	mark_dirty(DIRTY_LAYOUT);
 	if (user_config.warp_cursor && old_focused) {
 		warp_cursor(old_focused);
 	}
 	if (old_focused) {
-		send_wm_take_focus(old_focused->win);
+		send_wm_take_focus(old_focused);
+	}
+	mark_dirty(DIRTY_BORDERS);
+}
+
+void next_layout(void)
+{
+	set_layout((ws_layout[current_ws] + 1) % LAYOUT_COUNT);
+}
+
+Time motion_interval(int x, int y)
+{
+	int hz = user_config.motion_throttle;
+
+	/* 0 follows the refresh rate of the monitor under the pointer */
+	if (hz <= 0) {
+		hz = 60;
+		for (int i = 0; i < monsn; i++) {
+			if (x >= mons[i].x && x < mons[i].x + mons[i].w && y >= mons[i].y && y < mons[i].y + mons[i].h) {
+				if (mons[i].refresh > 0) {
+					hz = mons[i].refresh;
+				}
+				break;
+			}
+		}
 	}
-	update_borders();
+	return 1000 / hz;
 }
 
 void move_to_workspace(int ws)
@@ -1389,10 +3129,18 @@ void move_to_workspace(int ws)
 	if (focused->fullscreen) {
 		focused->fullscreen = False;
 		XMoveResizeWindow(dpy, focused->win, focused->orig_x, focused->orig_y, focused->orig_w, focused->orig_h);
+		COUNT(METRIC_CONFIGURE);
 		XSetWindowBorderWidth(dpy, focused->win, user_config.border_width);
 	}
 
-	XUnmapWindow(dpy, focused->win);
+	/* a batched switch has not shown this workspace yet, see show_workspace() */
+	if (batch_from_ws < 0 || batch_from_ws == current_ws) {
+		hide_client(focused);
+	}
+	else if (ws == batch_from_ws) {
+		/* already off-screen, the hide of the old workspace must not unmap it again */
+		focused->map_pending = True;
+	}
 	/* remove from current list */
 	Client **pp = &workspaces[current_ws];
 	while (*pp && *pp != focused) {
@@ -1406,12 +3154,11 @@ void move_to_workspace(int ws)
 	focused->next = workspaces[ws];
 	workspaces[ws] = focused;
 	focused->ws = ws;
-	long desktop = ws;
-	XChangeProperty(dpy, focused->win, XInternAtom(dpy, "_NET_WM_DESKTOP", False), XA_CARDINAL, 32, PropModeReplace,
-	                (unsigned char *)&desktop, 1);
+	update_client_desktop(focused);
+	ipc_client_event("move", focused);
 
 	/* tile current ws */
-	tile();
+	mark_dirty(DIRTY_LAYOUT);
 	focused = workspaces[current_ws];
 	if (focused) {
 		XSetInputFocus(dpy, focused->win, RevertToPointerRoot, CurrentTime);
@@ -1422,9 +3169,11 @@ void other_wm(void)
 {
 	XSetErrorHandler(other_wm_err);
 	XChangeWindowAttributes(dpy, root, CWEventMask, &(XSetWindowAttributes){.event_mask = SubstructureRedirectMask});
+	COUNT(METRIC_ROUNDTRIP);
 	XSync(dpy, False);
 	XSetErrorHandler(xerr);
 	XChangeWindowAttributes(dpy, root, CWEventMask, &(XSetWindowAttributes){.event_mask = 0});
+	COUNT(METRIC_ROUNDTRIP);
 	XSync(dpy, False);
 }
 
@@ -1464,94 +3213,152 @@ void quit(void)
 			XKillClient(dpy, c->win);
 		}
 	}
+	/* cursors belong to the connection, free them while it is still open */
+	Cursor cursors[] = {c_move, c_normal, c_resize};
+	for (size_t i = 0; i < LENGTH(cursors); i++) {
+		if (cursors[i]) {
+			XFreeCursor(dpy, cursors[i]);
+		}
+	}
+	COUNT(METRIC_ROUNDTRIP);
 	XSync(dpy, False);
 	XCloseDisplay(dpy);
-	XFreeCursor(dpy, c_move);
-	XFreeCursor(dpy, c_normal);
-	XFreeCursor(dpy, c_resize);
 	printf("quitting...\n");
 	running = False;
 }
 
+/* free what the parser allocated for binds, the built-in ones from config.h are static */
+void free_binds(Config *cfg)
+{
+	for (int i = 0; i < cfg->bindsn; i++) {
+		Binding *b = &cfg->binds[i];
+		if (b->type != TYPE_CMD || !b->action.cmd) {
+			continue;
+		}
+
+		Bool builtin = False;
+		for (unsigned long k = 0; k < LENGTH(binds); k++) {
+			if (binds[k].action.cmd == b->action.cmd) {
+				builtin = True;
+				break;
+			}
+		}
+		if (builtin) {
+			continue;
+		}
+
+		for (const char **arg = b->action.cmd; *arg; arg++) {
+			free((char *)*arg);
+		}
+		free(b->action.cmd);
+		b->action.cmd = NULL;
+	}
+}
+
+/* grab and ungrab only the keys whose binding appeared or disappeared */
+void regrab_keys(void)
+{
+	static short fresh[256][KEY_MODS];
+	build_key_dispatch(fresh);
+
+	for (int kc = 0; kc < 256; kc++) {
+		for (int m = 0; m < KEY_MODS; m++) {
+			if (key_dispatch[kc][m] >= 0 && fresh[kc][m] < 0) {
+				grab_key(kc, m, False);
+			}
+			else if (key_dispatch[kc][m] < 0 && fresh[kc][m] >= 0) {
+				grab_key(kc, m, True);
+			}
+		}
+	}
+	memcpy(key_dispatch, fresh, sizeof key_dispatch);
+}
+
 void reload_config(void)
 {
 	puts("sxwm: reloading config...");
+	/* the old config is kept to diff against and freed at the end */
+	Config old = user_config;
 	memset(&user_config, 0, sizeof(user_config));
-	for (int i = 0; i < user_config.bindsn; i++) {
-		free(user_config.binds[i].action.cmd);
-		user_config.binds[i].action.cmd = NULL;
-
-		user_config.binds[i].action.fn = NULL;
-		user_config.binds[i].type = -1;
-		user_config.binds[i].keysym = 0;
-		user_config.binds[i].mods = 0;
-	}
 
 	init_defaults();
+	/* any error, even a single typo, keeps the running config rather than applying half a file */
 	if (parser(&user_config)) {
-		fprintf(stderr, "sxrc: error parsing config file\n");
-		init_defaults();
+		fprintf(stderr, "sxwmrc: error parsing config file, keeping the running config\n");
+		free_binds(&user_config);
+		free_rules(&user_config);
+		for (int i = 0; i < 256; i++) {
+			free(user_config.torun[i]);
+		}
+		user_config = old;
+		return;
 	}
-	grab_keys();
-	XUngrabButton(dpy, AnyButton, AnyModifier, root);
-
-	for (int ws = 0; ws < NUM_WORKSPACES; ws++) {
-		for (Client *c = workspaces[ws]; c; c = c->next) {
-			XUngrabButton(dpy, AnyButton, AnyModifier, c->win);
+	/* only reset per-monitor and per-workspace state when the configured default changed */
+	for (int i = 0; i < monsn && user_config.master_width != old.master_width; i++) {
+		mons[i].mf = user_config.master_width;
+	}
+	for (int i = 0; i < NUM_WORKSPACES; i++) {
+		if (user_config.layout != old.layout) {
+			ws_layout[i] = user_config.layout;
+		}
+		if (user_config.nmaster != old.nmaster) {
+			ws_nmaster[i] = user_config.nmaster;
 		}
 	}
 
-	XGrabButton(dpy, Button1, user_config.modkey, root, True, ButtonPressMask | ButtonReleaseMask | PointerMotionMask,
-	            GrabModeAsync, GrabModeAsync, None, None);
-	XGrabButton(dpy, Button1, user_config.modkey | ShiftMask, root, True,
-	            ButtonPressMask | ButtonReleaseMask | PointerMotionMask, GrabModeAsync, GrabModeAsync, None, None);
-	XGrabButton(dpy, Button3, user_config.modkey, root, True, ButtonPressMask | ButtonReleaseMask | PointerMotionMask,
-	            GrabModeAsync, GrabModeAsync, None, None);
-
-	for (int ws = 0; ws < NUM_WORKSPACES; ws++) {
-		for (Client *c = workspaces[ws]; c; c = c->next) {
-			XGrabButton(dpy, Button1, 0, c->win, False, ButtonPressMask, GrabModeSync, GrabModeAsync, None, None);
-			XGrabButton(dpy, Button1, user_config.modkey, c->win, False, ButtonPressMask, GrabModeSync, GrabModeAsync,
-			            None, None);
-			XGrabButton(dpy, Button1, user_config.modkey | ShiftMask, c->win, False, ButtonPressMask, GrabModeSync,
-			            GrabModeAsync, None, None);
-			XGrabButton(dpy, Button3, user_config.modkey, c->win, False, ButtonPressMask, GrabModeSync, GrabModeAsync,
-			            None, None);
+	regrab_keys();
+	if (user_config.modkey != old.modkey) {
+		ungrab_buttons(root, old.modkey);
+		grab_buttons(root, user_config.modkey);
+		for (int ws = 0; ws < NUM_WORKSPACES; ws++) {
+			for (Client *c = workspaces[ws]; c; c = c->next) {
+				ungrab_buttons(c->win, old.modkey);
+				grab_buttons(c->win, user_config.modkey);
+			}
 		}
 	}
 
-	update_client_desktop_properties();
-	update_net_client_list();
+	if (user_config.gaps != old.gaps || user_config.border_width != old.border_width ||
+	    user_config.master_width != old.master_width || user_config.nmaster != old.nmaster ||
+	    user_config.layout != old.layout) {
+		mark_dirty(DIRTY_LAYOUT);
+	}
+	if (user_config.border_foc_col != old.border_foc_col || user_config.border_ufoc_col != old.border_ufoc_col) {
+		borders_stale = True;
+		mark_dirty(DIRTY_BORDERS);
+	}
 
-	XSync(dpy, False);
-	tile();
-	update_borders();
+	free_binds(&old);
+	free_rules(&old);
+	for (int i = 0; i < 256; i++) {
+		free(old.torun[i]);
+	}
+	/* a config may have appeared somewhere with higher priority */
+	watch_config();
 }
 
 void resize_master_add(void)
 {
-	/* pick the monitor of the focused window (or 0 if none) */
-	int m = focused ? focused->mon : 0;
-	float *mw = &user_config.master_width[m];
+	/* pick the monitor of the focused window (or the current one if none) */
+	int m = focused ? focused->mon : current_monitor;
+	float *mw = &mons[m].mf;
 
 	if (*mw < MF_MAX - 0.001f) {
 		*mw += ((float)user_config.resize_master_amt / 100);
 	}
-	tile();
-	update_borders();
+	mark_dirty(DIRTY_LAYOUT | DIRTY_BORDERS);
 }
 
 void resize_master_sub(void)
 {
-	/* pick the monitor of the focused window (or 0 if none) */
-	int m = focused ? focused->mon : 0;
-	float *mw = &user_config.master_width[m];
+	/* pick the monitor of the focused window (or the current one if none) */
+	int m = focused ? focused->mon : current_monitor;
+	float *mw = &mons[m].mf;
 
 	if (*mw > MF_MIN + 0.001f) {
 		*mw -= ((float)user_config.resize_master_amt / 100);
 	}
-	tile();
-	update_borders();
+	mark_dirty(DIRTY_LAYOUT | DIRTY_BORDERS);
 }
 
 void resize_stack_add(void)
@@ -1565,7 +3372,7 @@ void resize_stack_add(void)
 
 	int raw_new = raw_cur + user_config.resize_stack_amt;
 	focused->custom_stack_height = raw_new;
-	tile();
+	mark_dirty(DIRTY_LAYOUT);
 }
 
 void resize_stack_sub(void)
@@ -1584,16 +3391,115 @@ void resize_stack_sub(void)
 		raw_new = min_raw;
 	}
 	focused->custom_stack_height = raw_new;
-	tile();
+	mark_dirty(DIRTY_LAYOUT);
+}
+
+void raise_client(Client *c)
+{
+	XRaiseWindow(dpy, c->win);
+	if (stack_list_n > 0 && stack_list[stack_list_n - 1] == c->win) {
+		return;
+	}
+	for (int i = 0; i < stack_list_n; i++) {
+		if (stack_list[i] == c->win) {
+			memmove(&stack_list[i], &stack_list[i + 1], (stack_list_n - i - 1) * sizeof(Window));
+			stack_list[stack_list_n - 1] = c->win;
+			mark_dirty(DIRTY_STACKING);
+			break;
+		}
+	}
+}
+
+int rule_chain_match(int i, const WinInfo *wi, int best)
+{
+	/* chains are in config order, nothing past the best match so far can win */
+	for (; i >= 0 && (best < 0 || i < best); i = user_config.rules[i].next) {
+		if (rule_matches(&user_config.rules[i], wi)) {
+			return i;
+		}
+	}
+	return best;
+}
+
+/* first rule in the config that matches, only the buckets for this class and instance are searched */
+const Rule *rule_match(const WinInfo *wi)
+{
+	if (!user_config.rulesn) {
+		return NULL;
+	}
+
+	int best = rule_chain_match(user_config.rule_other, wi, -1);
+	if (wi->res_class) {
+		best = rule_chain_match(user_config.rule_class[rule_hash(wi->res_class) % RULE_BUCKETS], wi, best);
+	}
+	if (wi->res_name) {
+		best = rule_chain_match(user_config.rule_instance[rule_hash(wi->res_name) % RULE_BUCKETS], wi, best);
+	}
+	return best < 0 ? NULL : &user_config.rules[best];
+}
+
+Bool rule_matches(const Rule *r, const WinInfo *wi)
+{
+	if (r->class && (!wi->res_class || strcmp(r->class, wi->res_class))) {
+		return False;
+	}
+	if (r->instance && (!wi->res_name || strcmp(r->instance, wi->res_name))) {
+		return False;
+	}
+	if (r->title && (!wi->title || !strstr(wi->title, r->title))) {
+		return False;
+	}
+	if (r->type >= 0 && r->type != wi->type) {
+		return False;
+	}
+	return True;
+}
+
+/* re-exec in place, the new instance takes every window back as it was */
+void restart(void)
+{
+	Buf b = {0};
+	state_save(&b);
+	XChangeProperty(dpy, root, atoms[SXWM_STATE], XA_STRING, 8, PropModeReplace, (unsigned char *)b.data, b.len);
+	free(b.data);
+
+	/* let go of the root first, the new instance must not find it still redirected or grabbed */
+	XUngrabKey(dpy, AnyKey, AnyModifier, root);
+	ungrab_buttons(root, user_config.modkey);
+	XSelectInput(dpy, root, NoEventMask);
+	COUNT(METRIC_ROUNDTRIP);
+	XSync(dpy, False);
+
+	/* every fd is close-on-exec, the X connection included */
+	execvp(restart_argv[0], restart_argv);
+	warn("sxwm: restart %s", restart_argv[0]);
+
+	XDeleteProperty(dpy, root, atoms[SXWM_STATE]);
+	XSelectInput(dpy, root, ROOT_EVENT_MASK);
+	grab_keys();
+	grab_buttons(root, user_config.modkey);
 }
 
 void run(void)
 {
 	running = True;
 	XEvent xev;
+
 	while (running) {
-		XNextEvent(dpy, &xev);
-		xev_case(&xev);
+		/* Xlib may already hold events the kernel no longer reports, drain it before sleeping */
+		while (running && XPending(dpy)) {
+			XNextEvent(dpy, &xev);
+			xev_case(&xev);
+		}
+		if (!running) {
+			break;
+		}
+		flush_dirty();
+		/* round-trips in flush_dirty() can read events into Xlib's queue where epoll can't see them */
+		if (XEventsQueued(dpy, QueuedAlready)) {
+			continue;
+		}
+		loop_wait();
 	}
 }
 
@@ -1603,42 +3509,172 @@ void scan_existing_windows(void)
 	Window *children;
 	unsigned int nchildren;
 
-	if (XQueryTree(dpy, root, &root_return, &parent_return, &children, &nchildren)) {
-		for (unsigned int i = 0; i < nchildren; i++) {
-			XWindowAttributes wa;
-			if (!XGetWindowAttributes(dpy, children[i], &wa) || wa.override_redirect || wa.map_state != IsViewable) {
-				continue;
+	Bool restarted = state_load();
+	COUNT(METRIC_ROUNDTRIP);
+	if (!XQueryTree(dpy, root, &root_return, &parent_return, &children, &nchildren)) {
+		return;
+	}
+	WinFetch *wf = nchildren ? malloc(nchildren * sizeof *wf) : NULL;
+	if (!wf) {
+		if (children) {
+			XFree(children);
+		}
+		return;
+	}
+
+	/* one pipelined pass over every child instead of a fake MapRequest each */
+	for (unsigned int i = 0; i < nchildren; i++) {
+		wininfo_request(children[i], FETCH_DESKTOP, &wf[i]);
+	}
+
+	/* the replies arrive together, the whole pass waits about once */
+	COUNT(METRIC_ROUNDTRIP);
+	adopting = True;
+	for (unsigned int i = 0; i < nchildren; i++) {
+		WinInfo wi;
+		wininfo_collect(&wf[i], &wi);
+		/* a restart also hands over the windows hidden on other workspaces */
+		const SavedClient *sc = state_find(wf[i].win);
+		/* an override-redirect bar is never managed, but its struts still count */
+		if (wi.valid && wi.override_redirect && wi.is_dock && wi.map_state == IsViewable) {
+			dock_add(&wi);
+		}
+		else if (wi.valid && !wi.override_redirect && (wi.map_state == IsViewable || sc)) {
+			/* adopted windows stay on the monitor they are on, not the one under the pointer */
+			wi.has_pointer = True;
+			wi.ptr_x = wi.x + wi.w / 2;
+			wi.ptr_y = wi.y + wi.h / 2;
+			if (sc) {
+				wi.desktop = sc->ws;
+			}
+			Client *c = manage_window(&wi, True);
+			if (c && sc) {
+				c->mon = sc->mon < monsn ? sc->mon : c->mon;
+				c->floating = sc->floating || c->fixed;
+				c->fullscreen = sc->fullscreen;
+				c->custom_stack_height = sc->custom_stack_height;
+				/* a parked window's real position is the saved one */
+				c->x = sc->x;
+				c->y = sc->y;
+				c->w = sc->w;
+				c->h = sc->h;
+				c->orig_x = sc->orig_x;
+				c->orig_y = sc->orig_y;
+				c->orig_w = sc->orig_w;
+				c->orig_h = sc->orig_h;
 			}
+		}
+		wininfo_free(&wi);
+	}
+	adopting = False;
+	free(wf);
+	XFree(children);
+	if (restarted) {
+		state_restore_order();
+	}
+
+	/* one layout, one focus and one _NET_CLIENT_LIST update for the whole batch */
+	mark_dirty(DIRTY_CLIENTS | DIRTY_STACKING);
+	if (focused) {
+		mark_dirty(DIRTY_FOCUS);
+	}
+}
+
+void send_wm_take_focus(Client *c)
+{
+	if (!(c->protocols & PROTO_TAKE_FOCUS)) {
+		return;
+	}
+
+	XEvent ev = {
+	    .xclient = {.type = ClientMessage, .window = c->win, .message_type = atoms[WM_PROTOCOLS], .format = 32}};
+	ev.xclient.data.l[0] = atoms[WM_TAKE_FOCUS];
+	ev.xclient.data.l[1] = CurrentTime;
+	XSendEvent(dpy, c->win, False, NoEventMask, &ev);
+}
+
+void set_border(Client *c, long col)
+{
+	if (c->border_col != col) {
+		XSetWindowBorder(dpy, c->win, col);
+		COUNT(METRIC_BORDER);
+		c->border_col = col;
+	}
+}
 
-			XEvent fake_event = {0};
-			fake_event.type = MapRequest;
-			fake_event.xmaprequest.window = children[i];
-			hdl_map_req(&fake_event);
+void set_layout(int layout)
+{
+	if (layout < 0 || layout >= LAYOUT_COUNT || ws_layout[current_ws] == layout) {
+		return;
+	}
+	ws_layout[current_ws] = layout;
+
+	/* monocle stacks everything, keep the focused window on top */
+	if (layout == LAYOUT_MONOCLE && focused && !focused->floating) {
+		raise_client(focused);
+	}
+	mark_dirty(DIRTY_LAYOUT | DIRTY_BORDERS);
+}
+
+void show_client(Client *c)
+{
+	/* tiled windows are moved back by tile() */
+	if (c->parked && (c->floating || c->fullscreen)) {
+		if (c->fullscreen) {
+			XMoveWindow(dpy, c->win, mons[c->mon].x, mons[c->mon].y);
+			COUNT(METRIC_CONFIGURE);
 		}
-		if (children) {
-			XFree(children);
+		else {
+			XMoveWindow(dpy, c->win, c->x, c->y);
+			COUNT(METRIC_CONFIGURE);
 		}
+		c->parked = False;
 	}
+	XMapWindow(dpy, c->win);
+	c->map_pending = False;
 }
 
-void send_wm_take_focus(Window w)
+/* swap the windows of from for those of current_ws, then focus the new workspace */
+void show_workspace(int from)
 {
-	Atom wm_protocols = XInternAtom(dpy, "WM_PROTOCOLS", False);
-	Atom wm_take_focus = XInternAtom(dpy, "WM_TAKE_FOCUS", False);
-	Atom *protos;
-	int n;
-	if (XGetWMProtocols(dpy, w, &protos, &n)) {
-		for (int i = 0; i < n; i++) {
-			if (protos[i] == wm_take_focus) {
-				XEvent ev = {
-				    .xclient = {.type = ClientMessage, .window = w, .message_type = wm_protocols, .format = 32}};
-				ev.xclient.data.l[0] = wm_take_focus;
-				ev.xclient.data.l[1] = CurrentTime;
-				XSendEvent(dpy, w, False, NoEventMask, &ev);
+	/* also after a batch that switched back, windows moved here meanwhile are still hidden */
+	for (Client *c = workspaces[current_ws]; c; c = c->next) {
+		if (c->mapped) {
+			show_client(c);
+		}
+	}
+
+	/* only then hide the outgoing ones, so the root never flashes through */
+	if (from != current_ws) {
+		for (Client *c = workspaces[from]; c; c = c->next) {
+			if (c->mapped) {
+				hide_client(c);
 			}
 		}
-		XFree(protos);
 	}
+
+	if (focused) {
+		XSetInputFocus(dpy, focused->win, RevertToPointerRoot, CurrentTime);
+		if (user_config.warp_cursor) {
+			warp_cursor(focused);
+		}
+	}
+	else {
+		XSetInputFocus(dpy, root, RevertToPointerRoot, CurrentTime);
+	}
+
+	long cd = current_ws;
+	XChangeProperty(dpy, root, atoms[NET_CURRENT_DESKTOP], XA_CARDINAL, 32, PropModeReplace,
+	                (unsigned char *)&cd, 1);
+}
+
+void signal_to_pipe(int signo)
+{
+	int saved = errno;
+	unsigned char c = signo;
+	ssize_t r = write(signal_pipe[1], &c, 1);
+	(void)r;
+	errno = saved;
 }
 
 void setup(void)
@@ -1647,38 +3683,39 @@ void setup(void)
 		errx(0, "can't open display. quitting...");
 	}
 	root = XDefaultRootWindow(dpy);
+	xconn = XGetXCBConnection(dpy);
+	XExtCodes *codes = XAddExtension(dpy);
+	if (codes) {
+		XESetBeforeFlush(dpy, codes->extension, count_requests);
+	}
+	setup_loop();
 
 	setup_atoms();
 	other_wm();
+	setup_ipc();
+	trace_phase("display");
+
+	int randr_err, randr_major = 0, randr_minor = 0;
+	randr_ok = XRRQueryExtension(dpy, &randr_event_base, &randr_err) &&
+	           XRRQueryVersion(dpy, &randr_major, &randr_minor) &&
+	           (randr_major > 1 || (randr_major == 1 && randr_minor >= 5));
 	init_defaults();
-	if (parser(&user_config)) {
+	/* syntax errors were already reported, at startup the rest of the file still applies */
+	if (parser(&user_config) < 0) {
 		fprintf(stderr, "sxwmrc: error parsing config file\n");
 		init_defaults();
 	}
-	grab_keys();
-	startup_exec();
-
-	c_normal = XcursorLibraryLoadCursor(dpy, "left_ptr");
-	c_move = XcursorLibraryLoadCursor(dpy, "fleur");
-	c_resize = XcursorLibraryLoadCursor(dpy, "bottom_right_corner");
-	XDefineCursor(dpy, root, c_normal);
+	for (int i = 0; i < NUM_WORKSPACES; i++) {
+		ws_layout[i] = user_config.layout;
+		ws_nmaster[i] = user_config.nmaster;
+	}
+	trace_phase("config");
 
+	/* manage the root before anything can map, autostart clients then always find a ready wm */
 	scr_width = XDisplayWidth(dpy, DefaultScreen(dpy));
 	scr_height = XDisplayHeight(dpy, DefaultScreen(dpy));
 	update_monitors();
 
-	XSelectInput(dpy, root,
-	             StructureNotifyMask | SubstructureRedirectMask | SubstructureNotifyMask | KeyPressMask |
-	                 PropertyChangeMask);
-
-	XGrabButton(dpy, Button1, user_config.modkey, root, True, ButtonPressMask | ButtonReleaseMask | PointerMotionMask,
-	            GrabModeAsync, GrabModeAsync, None, None);
-	XGrabButton(dpy, Button1, user_config.modkey | ShiftMask, root, True,
-	            ButtonPressMask | ButtonReleaseMask | PointerMotionMask, GrabModeAsync, GrabModeAsync, None, None);
-	XGrabButton(dpy, Button3, user_config.modkey, root, True, ButtonPressMask | ButtonReleaseMask | PointerMotionMask,
-	            GrabModeAsync, GrabModeAsync, None, None);
-	XSync(dpy, False);
-
 	for (int i = 0; i < LASTEvent; i++) {
 		evtable[i] = hdl_dummy;
 	}
@@ -1690,162 +3727,435 @@ void setup(void)
 	evtable[ConfigureRequest] = hdl_config_req;
 	evtable[DestroyNotify] = hdl_destroy_ntf;
 	evtable[KeyPress] = hdl_keypress;
+	evtable[MapNotify] = hdl_map_ntf;
 	evtable[MapRequest] = hdl_map_req;
+	evtable[MappingNotify] = hdl_mapping_ntf;
 	evtable[MotionNotify] = hdl_motion;
-	evtable[PropertyNotify] = hdl_root_property;
+	evtable[PropertyNotify] = hdl_property;
 	evtable[UnmapNotify] = hdl_unmap_ntf;
+
+	XSelectInput(dpy, root, ROOT_EVENT_MASK);
+	if (randr_ok) {
+		XRRSelectInput(dpy, root, RRScreenChangeNotifyMask | RROutputChangeNotifyMask | RRCrtcChangeNotifyMask);
+	}
+
+	grab_keys();
+	grab_buttons(root, user_config.modkey);
+	watch_config();
+	COUNT(METRIC_ROUNDTRIP);
+	XSync(dpy, False);
+	trace_phase("root");
+
 	scan_existing_windows();
+	flush_dirty();
+	trace_phase("adopt");
+
+	startup_exec();
+	trace_phase("autostart");
+
+	setup_cursor();
+	trace_phase("cursor");
+
+	/* requests are counted as they are written, so flush what startup queued first */
+	XFlush(dpy);
+	startup_atom_requests = metrics[METRIC_ATOMS];
+}
 
-	signal(SIGCHLD, SIG_IGN); /* prevent child processes from becoming zombies */
+void setup_cursor(void)
+{
+	c_normal = XcursorLibraryLoadCursor(dpy, "left_ptr");
+	for (int s = 0; s < ScreenCount(dpy); s++) {
+		XDefineCursor(dpy, RootWindow(dpy, s), c_normal);
+	}
+}
+
+/* control socket for sxwmc, path exported as $SXWM_SOCKET to everything sxwm starts */
+void setup_ipc(void)
+{
+	ipc_addr.sun_family = AF_UNIX;
+	ipc_socket_path(ipc_addr.sun_path, sizeof ipc_addr.sun_path);
+
+	ipc_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (ipc_fd < 0) {
+		warn("sxwm: control socket");
+		return;
+	}
+	fcntl(ipc_fd, F_SETFL, fcntl(ipc_fd, F_GETFL) | O_NONBLOCK);
+	fcntl(ipc_fd, F_SETFD, FD_CLOEXEC);
+
+	/* other_wm() already made sure no other sxwm owns this display, so the path is stale */
+	unlink(ipc_addr.sun_path);
+	mode_t old_mask = umask(0077);
+	int r = bind(ipc_fd, (struct sockaddr *)&ipc_addr, sizeof ipc_addr);
+	umask(old_mask);
+	if (r < 0 || listen(ipc_fd, 8) < 0) {
+		warn("sxwm: control socket %s", ipc_addr.sun_path);
+		close(ipc_fd);
+		ipc_fd = -1;
+		return;
+	}
+
+	setenv("SXWM_SOCKET", ipc_addr.sun_path, 1);
+	loop_add(ipc_fd, hdl_ipc_accept);
+}
+
+/* linux: signalfd and timerfd on epoll, elsewhere a self-pipe and poll() timeouts */
+void setup_loop(void)
+{
+	const int sigs[] = {SIGCHLD, SIGHUP, SIGINT, SIGTERM, SIGUSR1};
+#ifdef __linux__
+	loop_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop_fd < 0) {
+		err(EXIT_FAILURE, "epoll_create1");
+	}
+
+	sigset_t set;
+	sigemptyset(&set);
+	for (size_t i = 0; i < LENGTH(sigs); i++) {
+		sigaddset(&set, sigs[i]);
+	}
+	sigprocmask(SIG_BLOCK, &set, NULL);
+	signal_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (signal_fd < 0) {
+		err(EXIT_FAILURE, "signalfd");
+	}
+	loop_add(signal_fd, hdl_signal);
+
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer_fd < 0) {
+		err(EXIT_FAILURE, "timerfd_create");
+	}
+	loop_add(timer_fd, hdl_timer);
+#else
+	if (pipe(signal_pipe) < 0) {
+		err(EXIT_FAILURE, "pipe");
+	}
+	for (int i = 0; i < 2; i++) {
+		fcntl(signal_pipe[i], F_SETFL, fcntl(signal_pipe[i], F_GETFL) | O_NONBLOCK);
+		fcntl(signal_pipe[i], F_SETFD, FD_CLOEXEC);
+	}
+	struct sigaction sa = {.sa_handler = signal_to_pipe, .sa_flags = SA_RESTART};
+	sigemptyset(&sa.sa_mask);
+	for (size_t i = 0; i < LENGTH(sigs); i++) {
+		sigaction(sigs[i], &sa, NULL);
+	}
+	loop_add(signal_pipe[0], hdl_signal);
+#endif
+	/* children come from posix_spawn() and must not inherit the X connection */
+	fcntl(ConnectionNumber(dpy), F_SETFD, FD_CLOEXEC);
+	loop_add(ConnectionNumber(dpy), hdl_xconn);
 }
 
 void setup_atoms(void)
 {
-	Atom a_num = XInternAtom(dpy, "_NET_NUMBER_OF_DESKTOPS", False);
-	Atom a_names = XInternAtom(dpy, "_NET_DESKTOP_NAMES", False);
-	atom_net_current_desktop = XInternAtom(dpy, "_NET_CURRENT_DESKTOP", False);
-	atom_net_active_window = XInternAtom(dpy, "_NET_ACTIVE_WINDOW", False);
-	atom_net_supported = XInternAtom(dpy, "_NET_SUPPORTED", False);
-	atom_wm_strut_partial = XInternAtom(dpy, "_NET_WM_STRUT_PARTIAL", False);
-	atom_wm_strut = XInternAtom(dpy, "_NET_WM_STRUT", False); /* legacy struts */
-	atom_wm_window_type = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE", False);
-	atom_net_wm_window_type_dock = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DOCK", False);
-	atom_net_workarea = XInternAtom(dpy, "_NET_WORKAREA", False);
-	atom_net_wm_state = XInternAtom(dpy, "_NET_WM_STATE", False);
-	atom_net_wm_state_fullscreen = XInternAtom(dpy, "_NET_WM_STATE_FULLSCREEN", False);
-	atom_net_wm_state = XInternAtom(dpy, "_NET_WM_STATE", False);
-	atom_net_wm_state_fullscreen = XInternAtom(dpy, "_NET_WM_STATE_FULLSCREEN", False);
-	atom_wm_delete = XInternAtom(dpy, "WM_DELETE_WINDOW", False);
-	atom_net_supporting_wm_check = XInternAtom(dpy, "_NET_SUPPORTING_WM_CHECK", False);
-	atom_net_wm_name = XInternAtom(dpy, "_NET_WM_NAME", False);
-	atom_utf8_string = XInternAtom(dpy, "UTF8_STRING", False);
-	atom_net_wm_desktop = XInternAtom(dpy, "_NET_WM_DESKTOP", False);
-	atom_net_client_list = XInternAtom(dpy, "_NET_CLIENT_LIST", False);
+	/* one batched request for every atom sxwm will ever need */
+	COUNT(METRIC_ROUNDTRIP);
+	if (!XInternAtoms(dpy, (char **)atom_names, ATOM_COUNT, False, atoms)) {
+		errx(1, "can't intern atoms");
+	}
 
 	Atom support_list[] = {
-	    atom_net_current_desktop,
-	    atom_net_active_window,
-	    atom_net_supported,
-	    atom_net_wm_state,
-	    atom_net_wm_state_fullscreen,
-	    atom_wm_window_type,
-	    atom_net_wm_window_type_dock,
-	    atom_net_workarea,
-	    atom_wm_strut,
-	    atom_wm_strut_partial,
-	    atom_wm_delete,
-	    atom_net_supporting_wm_check,
-	    atom_net_wm_name,
-	    atom_utf8_string,
-	    atom_net_wm_desktop,
-	    atom_net_client_list,
+	    atoms[NET_CURRENT_DESKTOP],
+	    atoms[NET_ACTIVE_WINDOW],
+	    atoms[NET_SUPPORTED],
+	    atoms[NET_WM_STATE],
+	    atoms[NET_WM_STATE_FULLSCREEN],
+	    atoms[NET_WM_WINDOW_TYPE],
+	    atoms[NET_WM_WINDOW_TYPE_DOCK],
+	    atoms[NET_WORKAREA],
+	    atoms[NET_WM_STRUT],
+	    atoms[NET_WM_STRUT_PARTIAL],
+	    atoms[WM_DELETE_WINDOW],
+	    atoms[NET_SUPPORTING_WM_CHECK],
+	    atoms[NET_WM_NAME],
+	    atoms[UTF8_STRING],
+	    atoms[NET_WM_DESKTOP],
+	    atoms[NET_CLIENT_LIST],
+	    atoms[NET_CLIENT_LIST_STACKING],
 	};
 
 	long num = NUM_WORKSPACES;
-	XChangeProperty(dpy, root, a_num, XA_CARDINAL, 32, PropModeReplace, (unsigned char *)&num, 1);
+	XChangeProperty(dpy, root, atoms[NET_NUMBER_OF_DESKTOPS], XA_CARDINAL, 32, PropModeReplace,
+	                (unsigned char *)&num, 1);
 
 	const char names[] = WORKSPACE_NAMES;
 	int names_len = sizeof(names);
 
-	XChangeProperty(dpy, root, a_names, XInternAtom(dpy, "UTF8_STRING", False), 8, PropModeReplace,
+	XChangeProperty(dpy, root, atoms[NET_DESKTOP_NAMES], atoms[UTF8_STRING], 8, PropModeReplace,
 	                (unsigned char *)names, names_len);
 
 	long initial = current_ws;
-	XChangeProperty(dpy, root, XInternAtom(dpy, "_NET_CURRENT_DESKTOP", False), XA_CARDINAL, 32, PropModeReplace,
+	XChangeProperty(dpy, root, atoms[NET_CURRENT_DESKTOP], XA_CARDINAL, 32, PropModeReplace,
 	                (unsigned char *)&initial, 1);
 
-	XChangeProperty(dpy, root, atom_net_supported, XA_ATOM, 32, PropModeReplace, (unsigned char *)support_list,
+	XChangeProperty(dpy, root, atoms[NET_SUPPORTED], XA_ATOM, 32, PropModeReplace, (unsigned char *)support_list,
 	                sizeof(support_list) / sizeof(Atom));
 
-	update_workarea();
+	/* drop whatever a previous window manager left behind */
+	update_net_client_list();
+	update_net_client_stacking();
 }
 
-Bool window_should_float(Window w)
+/* start argv, split on "|" into a pipeline, without waiting for any of it */
+void spawn(const char **argv)
 {
-	XClassHint ch;
-	if (XGetClassHint(dpy, w, &ch)) {
-		for (int i = 0; i < 256; i++) {
-			if (!user_config.should_float[i] || !user_config.should_float[i][0]) {
+	long start = now_us();
+	int n = 0;
+	while (argv[n]) {
+		n++;
+	}
+	/* stages are cut out of a copy, the bind keeps its argv for the next press */
+	const char **args = malloc((n + 1) * sizeof *args);
+	if (!args) {
+		return;
+	}
+	memcpy(args, argv, (n + 1) * sizeof *args);
+
+	/* the loop blocks its signals for signalfd, children get a clean mask in their own group */
+	posix_spawnattr_t attr;
+	sigset_t none;
+	sigemptyset(&none);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setsigmask(&attr, &none);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETPGROUP);
+
+	pid_t group = 0;
+	int in_fd = -1;
+	for (const char **stage = args;;) {
+		const char **end = stage;
+		while (*end && strcmp(*end, "|")) {
+			end++;
+		}
+		Bool last = !*end;
+		*end = NULL;
+
+		int fds[2] = {-1, -1};
+		if (!last) {
+			if (pipe(fds) < 0) {
+				warn("sxwm: pipe");
+				if (in_fd >= 0) {
+					close(in_fd);
+				}
 				break;
 			}
+			fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+			fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+		}
 
-			if ((ch.res_class && !strcmp(ch.res_class, user_config.should_float[i][0])) ||
-			    (ch.res_name && !strcmp(ch.res_name, user_config.should_float[i][0]))) {
-				XFree(ch.res_class);
-				XFree(ch.res_name);
-				return True;
-			}
+		posix_spawn_file_actions_t fa;
+		posix_spawn_file_actions_init(&fa);
+		if (in_fd >= 0) {
+			posix_spawn_file_actions_adddup2(&fa, in_fd, STDIN_FILENO);
+		}
+		if (!last) {
+			posix_spawn_file_actions_adddup2(&fa, fds[1], STDOUT_FILENO);
+		}
+		posix_spawnattr_setpgroup(&attr, group);
+
+		pid_t pid;
+		int r = stage[0] ? posix_spawnp(&pid, stage[0], &fa, &attr, (char *const *)stage, environ) : EINVAL;
+		posix_spawn_file_actions_destroy(&fa);
+		if (r) {
+			fprintf(stderr, "sxwm: cannot run '%s': %s\n", stage[0] ? stage[0] : "", strerror(r));
+			COUNT(METRIC_SPAWN_FAILED);
+		}
+		else {
+			COUNT(METRIC_SPAWN);
+			group = group ? group : pid;
+		}
+
+		if (in_fd >= 0) {
+			close(in_fd);
+		}
+		if (last) {
+			break;
 		}
-		XFree(ch.res_class);
-		XFree(ch.res_name);
+		close(fds[1]);
+		in_fd = fds[0];
+		stage = end + 1;
 	}
 
-	return False;
+	posix_spawnattr_destroy(&attr);
+	free(args);
+
+	hist_add(&spawn_hist, now_us() - start);
 }
 
-void spawn(const char **argv)
+int saved_cmp(const void *a, const void *b)
+{
+	Window x = ((const SavedClient *)a)->win, y = ((const SavedClient *)b)->win;
+	return (x > y) - (x < y);
+}
+
+const SavedClient *state_find(Window w)
+{
+	if (!savedn) {
+		return NULL;
+	}
+	SavedClient key = {.win = w};
+	return bsearch(&key, saved, savedn, sizeof *saved, saved_cmp);
+}
+
+/* read and delete the state restart() left on the root, True if there was one */
+Bool state_load(void)
 {
-	int pipe_idx = -1;
-	for (int i = 0; argv[i]; i++) {
-		if (strcmp(argv[i], "|") == 0) {
-			pipe_idx = i;
+	xcb_generic_error_t *e = NULL;
+	xcb_get_property_cookie_t ck = xcb_get_property(xconn, 1, root, atoms[SXWM_STATE], XCB_ATOM_STRING, 0, UINT32_MAX / 4);
+	COUNT(METRIC_ROUNDTRIP);
+	xcb_get_property_reply_t *r = xcb_get_property_reply(xconn, ck, &e);
+	free(e);
+	if (!r || r->format != 8 || !xcb_get_property_value_length(r)) {
+		free(r);
+		return False;
+	}
+	char *text = strndup(xcb_get_property_value(r), xcb_get_property_value_length(r));
+	free(r);
+	if (!text) {
+		return False;
+	}
+
+	int version = 0, cap = 0, ws, mon, layout, nmaster, floating, fullscreen;
+	unsigned long win;
+	float mf;
+	char *save;
+	for (char *line = strtok_r(text, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+		if (sscanf(line, "sxwm-state %d", &version) == 1) {
+			continue;
+		}
+		if (version != STATE_VERSION) {
 			break;
 		}
+		if (sscanf(line, "current %d %d %lx", &ws, &mon, &win) == 3) {
+			current_ws = CLAMP(ws, 0, NUM_WORKSPACES - 1);
+			current_monitor = CLAMP(mon, 0, monsn - 1);
+			saved_focus = win;
+		}
+		else if (sscanf(line, "ws %d %d %d", &ws, &layout, &nmaster) == 3 && ws >= 0 && ws < NUM_WORKSPACES) {
+			ws_layout[ws] = CLAMP(layout, 0, LAYOUT_COUNT - 1);
+			ws_nmaster[ws] = MAX(nmaster, 0);
+		}
+		else if (sscanf(line, "mon %d %f", &mon, &mf) == 2 && mon >= 0 && mon < monsn) {
+			mons[mon].mf = mf;
+		}
+		else if (!strncmp(line, "client ", 7) && grow_array((void **)&saved, &cap, savedn + 1, sizeof *saved)) {
+			SavedClient *sc = &saved[savedn];
+			if (sscanf(line + 7, "%lx %d %d %d %d %d %d %d %d %d %d %d %d %d", &win, &sc->ws, &sc->mon, &floating,
+			           &fullscreen, &sc->x, &sc->y, &sc->w, &sc->h, &sc->orig_x, &sc->orig_y, &sc->orig_w,
+			           &sc->orig_h, &sc->custom_stack_height) == 14) {
+				sc->win = win;
+				sc->order = savedn++;
+				sc->floating = floating;
+				sc->fullscreen = fullscreen;
+			}
+		}
+	}
+	free(text);
+	if (version != STATE_VERSION) {
+		savedn = 0;
+		return False;
 	}
 
-	if (pipe_idx < 0) {
-		if (fork() == 0) {
-			close(ConnectionNumber(dpy));
-			setsid();
-			execvp(argv[0], (char *const *)argv);
-			fprintf(stderr, "sxwm: execvp '%s' failed\n", argv[0]);
-			exit(EXIT_FAILURE);
+	qsort(saved, savedn, sizeof *saved, saved_cmp);
+	long cd = current_ws;
+	XChangeProperty(dpy, root, atoms[NET_CURRENT_DESKTOP], XA_CARDINAL, 32, PropModeReplace,
+	                (unsigned char *)&cd, 1);
+	return True;
+}
+
+/* put every workspace back in the saved order, windows the state did not know go last */
+void state_restore_order(void)
+{
+	Client **list = NULL;
+	int cap = 0;
+	for (int ws = 0; ws < NUM_WORKSPACES; ws++) {
+		int n = 0;
+		for (Client *c = workspaces[ws]; c; c = c->next) {
+			if (!grow_array((void **)&list, &cap, n + 1, sizeof *list)) {
+				break;
+			}
+			list[n++] = c;
+		}
+		/* insertion sort, the lists are short and mostly in order already */
+		for (int i = 1; i < n; i++) {
+			Client *c = list[i];
+			const SavedClient *sc = state_find(c->win);
+			int key = sc ? sc->order : INT_MAX;
+			int j = i;
+			for (; j > 0; j--) {
+				const SavedClient *p = state_find(list[j - 1]->win);
+				if ((p ? p->order : INT_MAX) <= key) {
+					break;
+				}
+				list[j] = list[j - 1];
+			}
+			list[j] = c;
+		}
+		for (int i = 0; i < n; i++) {
+			list[i]->next = i + 1 < n ? list[i + 1] : NULL;
 		}
+		workspaces[ws] = n ? list[0] : NULL;
 	}
-	else {
-		((char **)argv)[pipe_idx] = NULL;
-		const char **left = argv;
-		const char **right = argv + pipe_idx + 1;
-		int fd[2];
-		Bool x = pipe(fd);
-		(void)x;
+	free(list);
 
-		pid_t pid1 = fork();
-		if (pid1 == 0) {
-			dup2(fd[1], STDOUT_FILENO);
-			close(fd[0]);
-			close(fd[1]);
-			execvp(left[0], (char *const *)left);
-			perror("spawn left");
-			exit(EXIT_FAILURE);
-		}
+	Client *f = find_client(saved_focus);
+	if (f && f->ws == current_ws) {
+		focused = f;
+	}
+	free(saved);
+	saved = NULL;
+	savedn = 0;
+	mark_dirty(DIRTY_LAYOUT | DIRTY_BORDERS | DIRTY_CLIENTS);
+}
 
-		pid_t pid2 = fork();
-		if (pid2 == 0) {
-			dup2(fd[0], STDIN_FILENO);
-			close(fd[0]);
-			close(fd[1]);
-			execvp(right[0], (char *const *)right);
-			perror("spawn right");
-			exit(EXIT_FAILURE);
+void state_save(Buf *b)
+{
+	buf_printf(b, "sxwm-state %d\n", STATE_VERSION);
+	buf_printf(b, "current %d %d 0x%lx\n", current_ws, current_monitor, focused ? focused->win : None);
+	for (int ws = 0; ws < NUM_WORKSPACES; ws++) {
+		buf_printf(b, "ws %d %d %d\n", ws, ws_layout[ws], ws_nmaster[ws]);
+	}
+	for (int i = 0; i < monsn; i++) {
+		buf_printf(b, "mon %d %f\n", i, mons[i].mf);
+	}
+	/* in workspace order, withdrawn windows are left for the new instance to forget */
+	for (int ws = 0; ws < NUM_WORKSPACES; ws++) {
+		for (Client *c = workspaces[ws]; c; c = c->next) {
+			if (!c->mapped) {
+				continue;
+			}
+			buf_printf(b, "client 0x%lx %d %d %d %d %d %d %d %d %d %d %d %d %d\n", c->win, c->ws, c->mon,
+			           c->floating, c->fullscreen, c->x, c->y, c->w, c->h, c->orig_x, c->orig_y, c->orig_w,
+			           c->orig_h, c->custom_stack_height);
 		}
+	}
+}
 
-		close(fd[0]);
-		close(fd[1]);
-		waitpid(pid1, NULL, 0);
-		waitpid(pid2, NULL, 0);
+Window transient_from_reply(xcb_get_property_reply_t *r)
+{
+	if (r && r->format == 32 && xcb_get_property_value_length(r) >= 4) {
+		return *(xcb_window_t *)xcb_get_property_value(r);
 	}
+	return None;
 }
 
 void tile(void)
 {
-	update_struts();
+	dirty &= ~DIRTY_LAYOUT;
+	COUNT(METRIC_TILE);
 	Client *head = workspaces[current_ws];
 	int total = 0;
 
+	if (!grow_array((void **)&tile_mon, &tile_mon_cap, 2 * (monsn + 1), sizeof(int))) {
+		return;
+	}
+	int *mon_count = tile_mon;
+	int *mon_start = tile_mon + monsn + 1;
+	memset(tile_mon, 0, 2 * (monsn + 1) * sizeof(int));
+
 	for (Client *c = head; c; c = c->next) {
-		if (c->mapped && !c->floating && !c->fullscreen) {
+		if (c->mapped && !c->floating && !c->fullscreen && c->mon >= 0 && c->mon < monsn) {
 			total++;
+			mon_count[c->mon + 1]++;
 		}
 	}
 
@@ -1857,145 +4167,129 @@ void tile(void)
 		}
 	}
 
+	if (!grow_array((void **)&tile_order, &tile_order_cap, total, sizeof(Client *)) ||
+	    !grow_array((void **)&tile_heights, &tile_heights_cap, total, sizeof(int))) {
+		return;
+	}
+
+	/* lay the tiled clients out contiguously per monitor, keeping list order */
 	for (int m = 0; m < monsn; m++) {
-		int mon_x = mons[m].x, mon_y = mons[m].y + reserve_top;
-		int mon_w = mons[m].w, mon_h = mons[m].h - reserve_top - reserve_bottom;
-
-		Client *stackers[MAXCLIENTS];
-		int N = 0;
-		for (Client *c = head; c && N < MAXCLIENTS; c = c->next) {
-			if (c->mapped && !c->floating && !c->fullscreen && c->mon == m) {
-				stackers[N++] = c;
-			}
+		mon_start[m + 1] = mon_start[m] + mon_count[m + 1];
+		mon_count[m + 1] = 0;
+	}
+	for (Client *c = head; c; c = c->next) {
+		if (c->mapped && !c->floating && !c->fullscreen && c->mon >= 0 && c->mon < monsn) {
+			tile_order[mon_start[c->mon] + mon_count[c->mon + 1]++] = c;
 		}
+	}
+
+	int layout = ws_layout[current_ws];
+	for (int m = 0; m < monsn; m++) {
+		int mon_x = mons[m].x + mons[m].reserve_left, mon_y = mons[m].y + mons[m].reserve_top;
+		int mon_w = mons[m].w - mons[m].reserve_left - mons[m].reserve_right;
+		int mon_h = mons[m].h - mons[m].reserve_top - mons[m].reserve_bottom;
+
+		Client **stackers = tile_order + mon_start[m];
+		int N = mon_count[m + 1];
 
 		if (N == 0) {
 			continue;
 		}
 
-		int gx = user_config.gaps, gy = user_config.gaps;
-		int tile_x = mon_x + gx, tile_y = mon_y + gy;
-		int tile_w = MAX(1, mon_w - 2 * gx);
-		int tile_h = MAX(1, mon_h - 2 * gy);
-		float mf = CLAMP(user_config.master_width[m], MF_MIN, MF_MAX);
-		int master_w = (N > 1) ? (int)(tile_w * mf) : tile_w;
-		int stack_w = (N > 1) ? (tile_w - master_w - gx) : 0;
-
-		{
-			Client *c = stackers[0];
-			int bw2 = 2 * user_config.border_width;
-			XWindowChanges wc = {.x = tile_x,
-			                     .y = tile_y,
-			                     .width = MAX(1, master_w - bw2),
-			                     .height = MAX(1, tile_h - bw2),
-			                     .border_width = user_config.border_width};
-
-			if (c->x != wc.x || c->y != wc.y || c->w != wc.width || c->h != wc.height) {
-				XConfigureWindow(dpy, c->win, CWX | CWY | CWWidth | CWHeight | CWBorderWidth, &wc);
+		int gaps = user_config.gaps;
+		LayoutParams lp = {.n = N,
+		                   .nmaster = ws_nmaster[current_ws],
+		                   .gaps = gaps,
+		                   .border_width = user_config.border_width,
+		                   .mf = CLAMP(mons[m].mf, MF_MIN, MF_MAX),
+		                   .area = {mon_x + gaps, mon_y + gaps, MAX(1, mon_w - 2 * gaps), MAX(1, mon_h - 2 * gaps)},
+		                   .custom = NULL};
+
+		if (layout == LAYOUT_TILE) {
+			int *custom = tile_heights + mon_start[m];
+			for (int i = 0; i < N; i++) {
+				custom[i] = stackers[i]->custom_stack_height;
 			}
-
-			c->x = wc.x;
-			c->y = wc.y;
-			c->w = wc.width;
-			c->h = wc.height;
+			lp.custom = custom;
 		}
 
-		if (N == 1) {
-			update_borders();
+		const Rect *geom = layout_arrange(current_ws, m, layout, &lp);
+		if (!geom) {
 			continue;
 		}
 
 		int bw2 = 2 * user_config.border_width;
-		int num_stack = N - 1;
-		int min_raw = bw2 + 1;
-		int total_fixed_heights = 0, auto_count = 0;
-		int heights_final[MAXCLIENTS] = {0};
-		Bool is_fixed[MAXCLIENTS] = {0};
-
-		for (int i = 1; i < N; i++) {
-			if (stackers[i]->custom_stack_height > 0) {
-				is_fixed[i] = True;
-				total_fixed_heights += stackers[i]->custom_stack_height;
-			}
-			else {
-				auto_count++;
-			}
-		}
-
-		int total_vgaps = (num_stack - 1) * gy;
-		int remaining = tile_h - total_fixed_heights - total_vgaps;
-
-		if (auto_count > 0 && remaining >= auto_count * min_raw) {
-			int auto_h = remaining / auto_count, used = 0, count = 0;
-			for (int i = 1; i < N; i++) {
-				if (!is_fixed[i]) {
-					count++;
-					heights_final[i] = (count < auto_count) ? auto_h : remaining - used;
-					used += auto_h;
-				}
-				else {
-					heights_final[i] = stackers[i]->custom_stack_height;
-				}
-			}
-		}
-		else {
-			for (int i = 1; i < N; i++) {
-				if (is_fixed[i]) {
-					heights_final[i] = stackers[i]->custom_stack_height;
-				}
-				else {
-					heights_final[i] = min_raw;
-				}
-			}
-		}
-
-		int total_height = total_vgaps;
-		for (int i = 1; i < N; i++) {
-			total_height += heights_final[i];
-		}
-		int overfill = total_height - tile_h;
-		if (overfill > 0) {
-			/* shrink from top down, excluding bottom */
-			for (int i = 1; i < N - 1 && overfill > 0; i++) {
-				int shrink = MIN(overfill, heights_final[i] - min_raw);
-				heights_final[i] -= shrink;
-				overfill -= shrink;
-			}
-		}
-
-		/* if its not perfectly filled stretch bottom to absorb remainder */
-		int actual_height = total_vgaps;
-		for (int i = 1; i < N; i++) {
-			actual_height += heights_final[i];
-		}
-		int shortfall = tile_h - actual_height;
-		if (shortfall > 0) {
-			heights_final[N - 1] += shortfall;
-		}
-
-		int sy = tile_y;
-		for (int i = 1; i < N; i++) {
+		for (int i = 0; i < N; i++) {
 			Client *c = stackers[i];
-			XWindowChanges wc = {.x = tile_x + master_w + gx,
-			                     .y = sy,
-			                     .width = MAX(1, stack_w - (2 * user_config.border_width)),
-			                     .height = MAX(1, heights_final[i] - (2 * user_config.border_width)),
+			XWindowChanges wc = {.x = geom[i].x,
+			                     .y = geom[i].y,
+			                     .width = MAX(1, geom[i].w - bw2),
+			                     .height = MAX(1, geom[i].h - bw2),
 			                     .border_width = user_config.border_width};
 
-			if (c->x != wc.x || c->y != wc.y || c->w != wc.width || c->h != wc.height) {
+			if (c->parked || c->x != wc.x || c->y != wc.y || c->w != wc.width || c->h != wc.height) {
 				XConfigureWindow(dpy, c->win, CWX | CWY | CWWidth | CWHeight | CWBorderWidth, &wc);
+				COUNT(METRIC_CONFIGURE);
 			}
 
 			c->x = wc.x;
 			c->y = wc.y;
 			c->w = wc.width;
 			c->h = wc.height;
+			c->parked = False;
+		}
+	}
+}
 
-			sy += heights_final[i] + gy;
+void timer_arm(void)
+{
+#ifdef __linux__
+	long next = 0;
+	for (int i = 0; i < TIMER_COUNT; i++) {
+		if (timers[i] && (!next || timers[i] < next)) {
+			next = timers[i];
 		}
+	}
 
-		update_borders();
+	/* an all-zero value disarms it */
+	struct itimerspec its = {0};
+	if (next) {
+		its.it_value.tv_sec = next / 1000;
+		its.it_value.tv_nsec = (next % 1000) * 1000000L;
+	}
+	timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+#endif
+}
+
+/* run fn from timer_fns[id] in delay_ms, replacing any earlier deadline for it */
+void timer_set(int id, long delay_ms)
+{
+	/* 0 means unset, so a deadline can never be exactly 0 */
+	timers[id] = MAX(1, now_ms() + delay_ms);
+	timer_arm();
+}
+
+void timers_run(void)
+{
+	long now = now_ms();
+	for (int i = 0; i < TIMER_COUNT; i++) {
+		if (timers[i] && timers[i] <= now) {
+			timers[i] = 0;
+			timer_fns[i]();
+		}
+	}
+	timer_arm();
+}
+
+/* print the time since the previous phase with --startup-trace */
+void trace_phase(const char *phase)
+{
+	if (!startup_trace) {
+		return;
 	}
+	long now = now_us();
+	printf("sxwm: startup %-9s %8.2fms\n", phase, (now - trace_last) / 1000.0);
+	trace_last = now;
 }
 
 void toggle_floating(void)
@@ -2014,6 +4308,7 @@ void toggle_floating(void)
 
 	if (focused->floating) {
 		XWindowAttributes wa;
+		COUNT(METRIC_ROUNDTRIP);
 		if (XGetWindowAttributes(dpy, focused->win, &wa)) {
 			focused->x = wa.x;
 			focused->y = wa.y;
@@ -2023,6 +4318,7 @@ void toggle_floating(void)
 			XConfigureWindow(
 			    dpy, focused->win, CWX | CWY | CWWidth | CWHeight,
 			    &(XWindowChanges){.x = focused->x, .y = focused->y, .width = focused->w, .height = focused->h});
+			COUNT(METRIC_CONFIGURE);
 		}
 	}
 	else {
@@ -2032,12 +4328,11 @@ void toggle_floating(void)
 	if (!focused->floating) {
 		focused->mon = get_monitor_for(focused);
 	}
-	tile();
-	update_borders();
+	mark_dirty(DIRTY_LAYOUT | DIRTY_BORDERS);
 
 	/* raise and refocus floating window */
 	if (focused->floating) {
-		XRaiseWindow(dpy, focused->win);
+		raise_client(focused);
 		XSetInputFocus(dpy, focused->win, RevertToPointerRoot, CurrentTime);
 	}
 }
@@ -2057,6 +4352,7 @@ void toggle_floating_global(void)
 		c->floating = any_tiled;
 		if (c->floating) {
 			XWindowAttributes wa;
+			COUNT(METRIC_ROUNDTRIP);
 			XGetWindowAttributes(dpy, c->win, &wa);
 			c->x = wa.x;
 			c->y = wa.y;
@@ -2065,12 +4361,12 @@ void toggle_floating_global(void)
 
 			XConfigureWindow(dpy, c->win, CWX | CWY | CWWidth | CWHeight,
 			                 &(XWindowChanges){.x = c->x, .y = c->y, .width = c->w, .height = c->h});
-			XRaiseWindow(dpy, c->win);
+			COUNT(METRIC_CONFIGURE);
+			raise_client(c);
 		}
 	}
 
-	tile();
-	update_borders();
+	mark_dirty(DIRTY_LAYOUT | DIRTY_BORDERS);
 }
 
 void toggle_fullscreen(void)
@@ -2087,6 +4383,7 @@ void toggle_fullscreen(void)
 
 	if (focused->fullscreen) {
 		XWindowAttributes wa;
+		COUNT(METRIC_ROUNDTRIP);
 		XGetWindowAttributes(dpy, focused->win, &wa);
 		focused->orig_x = wa.x;
 		focused->orig_y = wa.y;
@@ -2101,89 +4398,221 @@ void toggle_fullscreen(void)
 
 		XSetWindowBorderWidth(dpy, focused->win, 0);
 		XMoveResizeWindow(dpy, focused->win, fs_x, fs_y, fs_w, fs_h);
-		XRaiseWindow(dpy, focused->win);
+		COUNT(METRIC_CONFIGURE);
+		raise_client(focused);
 	}
 	else {
 		XMoveResizeWindow(dpy, focused->win, focused->orig_x, focused->orig_y, focused->orig_w, focused->orig_h);
+		COUNT(METRIC_CONFIGURE);
 		XSetWindowBorderWidth(dpy, focused->win, user_config.border_width);
 
 		if (!focused->floating) {
 			focused->mon = get_monitor_for(focused);
 		}
-		tile();
-		update_borders();
+		mark_dirty(DIRTY_LAYOUT | DIRTY_BORDERS);
 	}
 }
 
+void toggle_grid(void)
+{
+	set_layout(ws_layout[current_ws] == LAYOUT_GRID ? LAYOUT_TILE : LAYOUT_GRID);
+}
+
+void toggle_horizontal(void)
+{
+	set_layout(ws_layout[current_ws] == LAYOUT_HORIZONTAL ? LAYOUT_TILE : LAYOUT_HORIZONTAL);
+}
+
+void toggle_monocle(void)
+{
+	set_layout(ws_layout[current_ws] == LAYOUT_MONOCLE ? LAYOUT_TILE : LAYOUT_MONOCLE);
+}
+
+void ungrab_buttons(Window w, int mod)
+{
+	XUngrabButton(dpy, Button1, mod, w);
+	XUngrabButton(dpy, Button1, mod | ShiftMask, w);
+	XUngrabButton(dpy, Button3, mod, w);
+}
+
 void update_borders(void)
 {
-	for (Client *c = workspaces[current_ws]; c; c = c->next) {
-		XSetWindowBorder(dpy, c->win, (c == focused ? user_config.border_foc_col : user_config.border_ufoc_col));
+	dirty &= ~DIRTY_BORDERS;
+	if (borders_stale) {
+		for (Client *c = workspaces[current_ws]; c; c = c->next) {
+			set_border(c, c == focused ? user_config.border_foc_col : user_config.border_ufoc_col);
+		}
+		borders_stale = False;
 	}
-	if (focused) {
-		Window w = focused->win;
-		XChangeProperty(dpy, root, atom_net_active_window, XA_WINDOW, 32, PropModeReplace, (unsigned char *)&w, 1);
+	else {
+		/* only the previous and the new focus can have changed */
+		if (border_focus && border_focus != focused) {
+			set_border(border_focus, user_config.border_ufoc_col);
+		}
+		if (focused) {
+			set_border(focused, user_config.border_foc_col);
+		}
+	}
+	border_focus = focused;
+
+	Window w = focused ? focused->win : None;
+	if (w != active_window) {
+		XChangeProperty(dpy, root, atoms[NET_ACTIVE_WINDOW], XA_WINDOW, 32, PropModeReplace, (unsigned char *)&w, 1);
+		active_window = w;
 	}
 }
 
-void update_client_desktop_properties(void)
+void update_client_desktop(Client *c)
 {
-	for (int ws = 0; ws < NUM_WORKSPACES; ws++) {
-		for (Client *c = workspaces[ws]; c; c = c->next) {
-			long desktop = ws;
-			XChangeProperty(dpy, c->win, XInternAtom(dpy, "_NET_WM_DESKTOP", False), XA_CARDINAL, 32, PropModeReplace,
-			                (unsigned char *)&desktop, 1);
-		}
-	}
+	long desktop = c->ws;
+	XChangeProperty(dpy, c->win, atoms[NET_WM_DESKTOP], XA_CARDINAL, 32, PropModeReplace, (unsigned char *)&desktop,
+	                1);
 }
 
 void update_monitors(void)
 {
-	XineramaScreenInfo *info;
-	Monitor *old = mons;
-
+	dirty &= ~DIRTY_MONITORS;
 	scr_width = XDisplayWidth(dpy, DefaultScreen(dpy));
 	scr_height = XDisplayHeight(dpy, DefaultScreen(dpy));
 
-	for (int s = 0; s < ScreenCount(dpy); s++) {
-		Window scr_root = RootWindow(dpy, s);
-		XDefineCursor(dpy, scr_root, c_normal);
+	int n = 0, primary = 0;
+	XRRMonitorInfo *info = NULL;
+	if (randr_ok) {
+		COUNT(METRIC_ROUNDTRIP);
+		info = XRRGetMonitors(dpy, root, True, &n);
+	}
+	Bool have_info = info && n > 0;
+	if (!have_info) {
+		n = 1;
+	}
+
+	Monitor *fresh = calloc(n, sizeof(Monitor));
+	Bool *taken = calloc(n, sizeof(Bool));
+	int *remap = calloc(monsn + 1, sizeof(int));
+	if (!fresh || !taken || !remap) {
+		fprintf(stderr, "sxwm: could not allocate monitors\n");
+		free(fresh);
+		free(taken);
+		free(remap);
+		if (info) {
+			XRRFreeMonitors(info);
+		}
+		return;
 	}
 
-	if (XineramaIsActive(dpy)) {
-		info = XineramaQueryScreens(dpy, &monsn);
-		mons = malloc(sizeof *mons * monsn);
-		for (int i = 0; i < monsn; i++) {
-			mons[i].x = info[i].x_org;
-			mons[i].y = info[i].y_org;
-			mons[i].w = info[i].width;
-			mons[i].h = info[i].height;
+	if (have_info) {
+		for (int i = 0; i < n; i++) {
+			fresh[i].name = info[i].name;
+			fresh[i].x = info[i].x;
+			fresh[i].y = info[i].y;
+			fresh[i].w = info[i].width;
+			fresh[i].h = info[i].height;
+			if (info[i].primary) {
+				primary = i;
+			}
 		}
-		XFree(info);
 	}
 	else {
-		monsn = 1;
-		mons = malloc(sizeof *mons);
-		mons[0].x = 0;
-		mons[0].y = 0;
-		mons[0].w = scr_width;
-		mons[0].h = scr_height;
+		fresh[0].name = None;
+		fresh[0].w = scr_width;
+		fresh[0].h = scr_height;
+	}
+	if (info) {
+		XRRFreeMonitors(info);
 	}
 
-	free(old);
-}
+	/* carry per-output state over to the monitors that survived */
+	Bool changed = (n != monsn);
+	for (int i = 0; i < monsn; i++) {
+		remap[i] = -1;
+		for (int j = 0; j < n; j++) {
+			if (!taken[j] && fresh[j].name == mons[i].name) {
+				Monitor geom = fresh[j];
+				fresh[j] = mons[i];
+				fresh[j].x = geom.x;
+				fresh[j].y = geom.y;
+				fresh[j].w = geom.w;
+				fresh[j].h = geom.h;
+				remap[i] = j;
+				taken[j] = True;
+				break;
+			}
+		}
+		if (remap[i] < 0) {
+			for (int ws = 0; ws < NUM_WORKSPACES; ws++) {
+				free(mons[i].cache[ws].geom);
+				free(mons[i].cache[ws].custom);
+			}
+			changed = True;
+		}
+		else if (remap[i] != i || mons[i].x != fresh[remap[i]].x || mons[i].y != fresh[remap[i]].y ||
+		         mons[i].w != fresh[remap[i]].w || mons[i].h != fresh[remap[i]].h) {
+			changed = True;
+		}
+	}
 
-void update_net_client_list(void)
-{
-	Window wins[MAXCLIENTS];
-	int n = 0;
+	if (mons && !changed) {
+		free(fresh);
+		free(taken);
+		free(remap);
+		return;
+	}
+
+	for (int j = 0; j < n; j++) {
+		if (!taken[j]) {
+			fresh[j].mf = user_config.master_width;
+		}
+	}
+
+	/* clients on an unplugged output move to the primary monitor */
 	for (int ws = 0; ws < NUM_WORKSPACES; ws++) {
 		for (Client *c = workspaces[ws]; c; c = c->next) {
-			wins[n++] = c->win;
+			int m = (c->mon >= 0 && c->mon < monsn) ? remap[c->mon] : -1;
+			if (m >= 0) {
+				c->mon = m;
+				continue;
+			}
+			c->mon = primary;
+			Monitor *t = &fresh[primary];
+			if (c->fullscreen) {
+				XMoveResizeWindow(dpy, c->win, t->x, t->y, t->w, t->h);
+				COUNT(METRIC_CONFIGURE);
+			}
+			else if (c->floating) {
+				c->x = t->x + MAX(0, (t->w - c->w) / 2);
+				c->y = t->y + MAX(0, (t->h - c->h) / 2);
+				XMoveWindow(dpy, c->win, c->x, c->y);
+				COUNT(METRIC_CONFIGURE);
+			}
 		}
 	}
-	Atom prop = XInternAtom(dpy, "_NET_CLIENT_LIST", False);
-	XChangeProperty(dpy, root, prop, XA_WINDOW, 32, PropModeReplace, (unsigned char *)wins, n);
+	current_monitor = (current_monitor < monsn && remap[current_monitor] >= 0) ? remap[current_monitor] : primary;
+
+	free(mons);
+	free(taken);
+	free(remap);
+	mons = fresh;
+	monsn = n;
+
+	update_refresh_rates();
+	update_workarea();
+	mark_dirty(DIRTY_STRUTS | DIRTY_LAYOUT | DIRTY_BORDERS);
+	ipc_event(EV_MONITOR, "monitors %d\n", monsn);
+}
+
+void update_net_client_list(void)
+{
+	/* only removals get here, additions are appended in place by client_list_add() */
+	dirty &= ~DIRTY_CLIENTS;
+	XChangeProperty(dpy, root, atoms[NET_CLIENT_LIST], XA_WINDOW, 32, PropModeReplace, (unsigned char *)client_list,
+	                client_list_n);
+}
+
+void update_net_client_stacking(void)
+{
+	dirty &= ~DIRTY_STACKING;
+	XChangeProperty(dpy, root, atoms[NET_CLIENT_LIST_STACKING], XA_WINDOW, 32, PropModeReplace,
+	                (unsigned char *)stack_list, stack_list_n);
 }
 
 void warp_cursor(Client *c)
@@ -2192,15 +4621,234 @@ void warp_cursor(Client *c)
 		return;
 	}
 
-	int center_x = c->x + (c->w / 2);
-	int center_y = c->y + (c->h / 2);
+	/* done in flush_dirty() so it lands on the final geometry */
+	warp_target = c;
+	mark_dirty(DIRTY_WARP);
+}
 
-	XWarpPointer(dpy, None, root, 0, 0, 0, 0, center_x, center_y);
-	XSync(dpy, False);
+/* watch the directory of the config in use and of every path that would take priority over it */
+void watch_config(void)
+{
+#ifdef __linux__
+	if (config_watch_fd < 0) {
+		config_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (config_watch_fd < 0) {
+			return;
+		}
+		loop_add(config_watch_fd, hdl_config_watch);
+	}
+
+	char paths[CONFIG_PATHS][PATH_MAX];
+	int n = config_paths(paths);
+	Bool past_current = False;
+	for (int i = 0; i < CONFIG_PATHS; i++) {
+		if (config_watch_wd[i] >= 0) {
+			inotify_rm_watch(config_watch_fd, config_watch_wd[i]);
+			config_watch_wd[i] = -1;
+		}
+		if (i >= n || past_current) {
+			continue;
+		}
+
+		past_current = !strcmp(paths[i], user_config.path);
+		char *slash = strrchr(paths[i], '/');
+		*slash = '\0';
+		/* a missing directory just means nothing can be found there */
+		config_watch_wd[i] =
+		    inotify_add_watch(config_watch_fd, paths[i], IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM);
+	}
+#endif
+}
+
+void wininfo_collect(WinFetch *wf, WinInfo *wi)
+{
+	memset(wi, 0, sizeof *wi);
+	wi->win = wf->win;
+
+	/* every reply has to be read, even when an earlier one failed */
+	xcb_generic_error_t *e = NULL;
+	xcb_get_window_attributes_reply_t *attr = xcb_get_window_attributes_reply(xconn, wf->attr, &e);
+	free(e);
+	e = NULL;
+	xcb_get_geometry_reply_t *geom = xcb_get_geometry_reply(xconn, wf->geom, &e);
+	free(e);
+	e = NULL;
+	xcb_get_property_reply_t *type = xcb_get_property_reply(xconn, wf->type, &e);
+	free(e);
+	e = NULL;
+	xcb_get_property_reply_t *class = xcb_get_property_reply(xconn, wf->class, &e);
+	free(e);
+	e = NULL;
+	xcb_get_property_reply_t *transient = xcb_get_property_reply(xconn, wf->transient, &e);
+	free(e);
+	e = NULL;
+	xcb_get_property_reply_t *hints = xcb_get_property_reply(xconn, wf->hints, &e);
+	free(e);
+	e = NULL;
+	xcb_get_property_reply_t *protocols = xcb_get_property_reply(xconn, wf->protocols, &e);
+	free(e);
+	e = NULL;
+	xcb_get_property_reply_t *strut_partial = xcb_get_property_reply(xconn, wf->strut_partial, &e);
+	free(e);
+	e = NULL;
+	xcb_get_property_reply_t *strut = xcb_get_property_reply(xconn, wf->strut, &e);
+	free(e);
+	e = NULL;
+	xcb_get_property_reply_t *net_name = NULL;
+	xcb_get_property_reply_t *name = NULL;
+	if (wf->want_title) {
+		net_name = xcb_get_property_reply(xconn, wf->net_name, &e);
+		free(e);
+		e = NULL;
+		name = xcb_get_property_reply(xconn, wf->name, &e);
+		free(e);
+		e = NULL;
+	}
+	xcb_query_pointer_reply_t *pointer = NULL;
+	if (wf->want & FETCH_POINTER) {
+		pointer = xcb_query_pointer_reply(xconn, wf->pointer, &e);
+		free(e);
+		e = NULL;
+	}
+	xcb_get_property_reply_t *desktop = NULL;
+	if (wf->want & FETCH_DESKTOP) {
+		desktop = xcb_get_property_reply(xconn, wf->desktop, &e);
+		free(e);
+	}
+
+	if (attr && geom) {
+		wi->valid = True;
+		wi->override_redirect = attr->override_redirect;
+		wi->map_state = attr->map_state;
+		wi->x = geom->x;
+		wi->y = geom->y;
+		wi->w = geom->width;
+		wi->h = geom->height;
+	}
+
+	if (type && type->format == 32) {
+		xcb_atom_t *types = xcb_get_property_value(type);
+		int n = xcb_get_property_value_length(type) / 4;
+		for (int i = 0; i < n; i++) {
+			if (types[i] == atoms[NET_WM_WINDOW_TYPE_DOCK]) {
+				wi->is_dock = True;
+				break;
+			}
+			if (types[i] == atoms[NET_WM_WINDOW_TYPE_DIALOG]) {
+				wi->type = WIN_TYPE_DIALOG;
+			}
+			else if (types[i] == atoms[NET_WM_WINDOW_TYPE_UTILITY]) {
+				wi->type = WIN_TYPE_UTILITY;
+			}
+			else if (types[i] == atoms[NET_WM_WINDOW_TYPE_TOOLBAR]) {
+				wi->type = WIN_TYPE_TOOLBAR;
+			}
+			else if (types[i] == atoms[NET_WM_WINDOW_TYPE_SPLASH]) {
+				wi->type = WIN_TYPE_SPLASH;
+			}
+			else if (types[i] == atoms[NET_WM_WINDOW_TYPE_POPUP_MENU]) {
+				wi->type = WIN_TYPE_POPUP_MENU;
+			}
+			else {
+				continue;
+			}
+			wi->float_type = True;
+			break;
+		}
+	}
+
+	/* WM_CLASS is "instance\0class\0" */
+	if (class && class->format == 8) {
+		int len = xcb_get_property_value_length(class);
+		const char *v = xcb_get_property_value(class);
+		int name_len = strnlen(v, len);
+		wi->res_name = strndup(v, name_len);
+		if (name_len + 1 < len) {
+			wi->res_class = strndup(v + name_len + 1, len - name_len - 1);
+		}
+	}
+
+	/* only fetched when a rule matches on titles, _NET_WM_NAME wins over WM_NAME */
+	xcb_get_property_reply_t *title = net_name && xcb_get_property_value_length(net_name) ? net_name : name;
+	if (title && title->format == 8) {
+		wi->title = strndup(xcb_get_property_value(title), xcb_get_property_value_length(title));
+	}
+
+	wi->transient_for = transient_from_reply(transient);
+	wi->protocols = protocols_from_reply(protocols);
+	size_hints_from_reply(hints, &wi->hints);
+
+	if (wi->is_dock) {
+		strut_from_replies(strut_partial, strut, wi->strut);
+	}
+
+	if (pointer && pointer->same_screen) {
+		wi->has_pointer = True;
+		wi->ptr_x = pointer->root_x;
+		wi->ptr_y = pointer->root_y;
+	}
+
+	wi->desktop = -1;
+	if (desktop && desktop->format == 32 && xcb_get_property_value_length(desktop) >= 4) {
+		wi->desktop = *(uint32_t *)xcb_get_property_value(desktop);
+	}
+
+	free(attr);
+	free(geom);
+	free(type);
+	free(class);
+	free(transient);
+	free(hints);
+	free(protocols);
+	free(strut_partial);
+	free(strut);
+	free(net_name);
+	free(name);
+	free(pointer);
+	free(desktop);
+}
+
+void wininfo_free(WinInfo *wi)
+{
+	free(wi->res_name);
+	free(wi->res_class);
+	free(wi->title);
+	wi->res_name = NULL;
+	wi->res_class = NULL;
+	wi->title = NULL;
+}
+
+void wininfo_request(Window w, unsigned int want, WinFetch *wf)
+{
+	/* no round-trips here, the replies are read in wininfo_collect() */
+	wf->win = w;
+	wf->attr = xcb_get_window_attributes(xconn, w);
+	wf->geom = xcb_get_geometry(xconn, w);
+	wf->type = xcb_get_property(xconn, 0, w, atoms[NET_WM_WINDOW_TYPE], XCB_ATOM_ATOM, 0, 8);
+	wf->class = xcb_get_property(xconn, 0, w, XCB_ATOM_WM_CLASS, XCB_ATOM_STRING, 0, 64);
+	wf->transient = xcb_get_property(xconn, 0, w, XCB_ATOM_WM_TRANSIENT_FOR, XCB_ATOM_WINDOW, 0, 1);
+	wf->hints = xcb_get_property(xconn, 0, w, XCB_ATOM_WM_NORMAL_HINTS, XCB_ATOM_WM_SIZE_HINTS, 0, 18);
+	wf->protocols = xcb_get_property(xconn, 0, w, atoms[WM_PROTOCOLS], XCB_ATOM_ATOM, 0, 16);
+	wf->strut_partial = xcb_get_property(xconn, 0, w, atoms[NET_WM_STRUT_PARTIAL], XCB_ATOM_CARDINAL, 0, 12);
+	wf->strut = xcb_get_property(xconn, 0, w, atoms[NET_WM_STRUT], XCB_ATOM_CARDINAL, 0, 4);
+	wf->want_title = user_config.rule_titles;
+	if (wf->want_title) {
+		wf->net_name = xcb_get_property(xconn, 0, w, atoms[NET_WM_NAME], atoms[UTF8_STRING], 0, 64);
+		wf->name = xcb_get_property(xconn, 0, w, XCB_ATOM_WM_NAME, XCB_ATOM_ANY, 0, 64);
+	}
+	wf->want = want;
+	if (want & FETCH_POINTER) {
+		wf->pointer = xcb_query_pointer(xconn, root);
+	}
+	if (want & FETCH_DESKTOP) {
+		wf->desktop = xcb_get_property(xconn, 0, w, atoms[NET_WM_DESKTOP], XCB_ATOM_CARDINAL, 0, 1);
+	}
 }
 
 int xerr(Display *dpy, XErrorEvent *ee)
 {
+	xerrors[ee->request_code]++;
+
 	/* ignore noise & non fatal errors */
 	const struct {
 		int req, code;
@@ -2224,8 +4872,14 @@ int xerr(Display *dpy, XErrorEvent *ee)
 
 void xev_case(XEvent *xev)
 {
-	if (xev->type >= 0 && xev->type < LASTEvent) {
+	long start = now_us();
+	if (randr_ok && (xev->type == randr_event_base + RRScreenChangeNotify || xev->type == randr_event_base + RRNotify)) {
+		hdl_randr(xev);
+		hist_add(&event_hist[LASTEvent], now_us() - start);
+	}
+	else if (xev->type >= 0 && xev->type < LASTEvent) {
 		evtable[xev->type](xev);
+		hist_add(&event_hist[xev->type], now_us() - start);
 	}
 	else {
 		printf("sxwm: invalid event type: %d\n", xev->type);
@@ -2234,24 +4888,34 @@ void xev_case(XEvent *xev)
 
 int main(int ac, char **av)
 {
-	if (ac > 1) {
-		if (strcmp(av[1], "-v") == 0 || strcmp(av[1], "--version") == 0) {
+	for (int i = 1; i < ac; i++) {
+		if (strcmp(av[i], "-v") == 0 || strcmp(av[i], "--version") == 0) {
 			printf("%s\n%s\n%s\n", SXWM_VERSION, SXWM_AUTHOR, SXWM_LICINFO);
 			exit(0);
 		}
-		else if (strcmp(av[1], "-b") == 0 || strcmp(av[1], "--backup") == 0) {
+		else if (strcmp(av[i], "-b") == 0 || strcmp(av[i], "--backup") == 0) {
 			puts("sxwm: using backup keybinds");
 			backup_binds = True;
 		}
+		else if (strcmp(av[i], "--startup-trace") == 0) {
+			startup_trace = True;
+		}
 		else {
 			puts("usege:\n");
 			puts("\t[-v || --version]: See the version of sxwm\n");
 			puts("\t[-b || --backup]: Use backup set of keybinds with sxwm\n");
+			puts("\t[--startup-trace]: Print the time spent in each startup phase\n");
 			exit(0);
 		}
 	}
+	restart_argv = av;
+	long start = trace_last = now_us();
 	setup();
+	if (startup_trace) {
+		printf("sxwm: startup %-9s %8.2fms\n", "total", (now_us() - start) / 1000.0);
+	}
 	printf("sxwm: starting...\n");
 	run();
+	ipc_cleanup();
 	return 0;
 }
@@ -0,0 +1,113 @@
+/* See LICENSE for more information on use */
+/* sxwmc: send commands to sxwm over its control socket */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* keep in sync with ipc_socket_path() in sxwm.c */
+static void socket_path(char *out, size_t n)
+{
+	const char *env = getenv("SXWM_SOCKET");
+	if (env && *env) {
+		snprintf(out, n, "%s", env);
+		return;
+	}
+
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	const char *display = getenv("DISPLAY");
+	char disp[64];
+	snprintf(disp, sizeof disp, "%s", display ? display : ":0");
+	for (char *p = disp; *p; p++) {
+		if (*p == '/') {
+			*p = '_';
+		}
+	}
+
+	if (dir && *dir) {
+		snprintf(out, n, "%s/sxwm-%s.sock", dir, disp);
+	}
+	else {
+		snprintf(out, n, "/tmp/sxwm-%d-%s.sock", (int)getuid(), disp);
+	}
+}
+
+static int write_all(int fd, const char *data, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, data, len);
+		if (n <= 0) {
+			return -1;
+		}
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static void usage(void)
+{
+	puts("usage: sxwmc command [args...]");
+	puts("       sxwmc -        read commands from stdin, one per line");
+	puts("");
+	puts("commands can be chained with ';' and run as one batch, e.g.");
+	puts("       sxwmc 'set gaps 4; workspace move 2; query clients'");
+	puts("");
+	puts("'sxwmc subscribe [class...]' keeps printing events until sxwm exits");
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2 || !strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")) {
+		usage();
+		return argc < 2;
+	}
+
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	socket_path(addr.sun_path, sizeof addr.sun_path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof addr) < 0) {
+		fprintf(stderr, "sxwmc: cannot connect to %s\n", addr.sun_path);
+		return 1;
+	}
+
+	/* subscribers read the replies as a stream, hand every line on as soon as it arrives */
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	/* the whole message is one batch, the end is marked by closing our side */
+	if (!strcmp(argv[1], "-")) {
+		char buf[4096];
+		size_t n;
+		while ((n = fread(buf, 1, sizeof buf, stdin)) > 0) {
+			if (write_all(fd, buf, n)) {
+				break;
+			}
+		}
+	}
+	else {
+		for (int i = 1; i < argc; i++) {
+			write_all(fd, argv[i], strlen(argv[i]));
+			write_all(fd, i + 1 < argc ? " " : "\n", 1);
+		}
+	}
+	shutdown(fd, SHUT_WR);
+
+	/* exit status tells scripts whether any command failed */
+	int status = 0;
+	FILE *in = fdopen(fd, "r");
+	char line[1024];
+	while (in && fgets(line, sizeof line, in)) {
+		if (!strncmp(line, "error:", 6)) {
+			status = 1;
+		}
+		fputs(line, stdout);
+	}
+	if (in) {
+		fclose(in);
+	}
+	return status;
+}